@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+
+// benchmark results as json, and the comparison against results saved earlier.
+// shared by the benchmarks that make bench tracks
+struct Result {
+    std::string name;
+    int         sectors;
+    long long   iterations;
+    double      ns_per_op;
+};
+
+
+inline bool write_json(const char* name, const std::vector<Result>& results) {
+    FILE* f = fopen(name, "wb");
+    if (!f) return false;
+    fprintf(f, "{\n  \"benchmarks\": [\n");
+    for (int i = 0; i < (int) results.size(); ++i) {
+        const Result& r = results[i];
+        fprintf(f, "    { \"name\": \"%s\", \"sectors\": %d, \"iterations\": %lld, \"ns_per_op\": %.1f }%s\n",
+                r.name.c_str(), r.sectors, r.iterations, r.ns_per_op, i + 1 < (int) results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+
+// reads what write_json wrote, one result per line
+inline bool read_json(const char* name, std::vector<Result>& results) {
+    FILE* f = fopen(name, "rb");
+    if (!f) return false;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char n[64];
+        Result r;
+        if (sscanf(line, " { \"name\": \"%63[^\"]\", \"sectors\": %d, \"iterations\": %lld, \"ns_per_op\": %lf",
+                   n, &r.sectors, &r.iterations, &r.ns_per_op) != 4) continue;
+        r.name = n;
+        results.push_back(r);
+    }
+    fclose(f);
+    return true;
+}
+
+
+// prints every result that is in the baseline too, returns the number of regressions
+inline int compare(const std::vector<Result>& baseline, const std::vector<Result>& results, double threshold) {
+    std::map<std::pair<std::string, int>, double> old;
+    for (const Result& r : baseline) old[{ r.name, r.sectors }] = r.ns_per_op;
+    printf("\n%-20s %7s %14s %14s %8s\n", "compared to baseline", "sectors", "old ns/op", "new ns/op", "change");
+    int regressions = 0;
+    for (const Result& r : results) {
+        auto it = old.find({ r.name, r.sectors });
+        if (it == old.end()) continue;
+        double change = (r.ns_per_op / it->second - 1) * 100;
+        bool slower = change > threshold;
+        regressions += slower;
+        printf("%-20s %7d %14.1f %14.1f %+7.1f%%%s\n", r.name.c_str(), r.sectors, it->second, r.ns_per_op, change,
+               slower ? "  SLOWER" : "");
+    }
+    return regressions;
+}
@@ -0,0 +1,273 @@
+// latency of editor operations on generated maps of increasing size, no window needed
+//
+//     make bench
+//     bench/editor_macro [-runs n] [-script file] [-json file] [-baseline file] [-threshold percent] [sectors...]
+//
+// 1000 and 10000 sectors by default. -json writes the median and 90th percentile latency of every op,
+// -baseline compares against results written earlier and fails if any of them got slower by more than
+// -threshold percent, 25 by default as single edits are noisier than the map_core loops.
+// save a baseline with: cp bench/editor_results.json bench/editor_baseline.json
+//
+// the macro is replayed -runs times per map, each time around another randomly picked sector.
+// one command per line, # starts a comment:
+//     pick                  pick the sector the following commands work on
+//     clear                 clear the selection
+//     corner i              add vertex i of the picked sector and everything on top of it
+//     portal                add both ends of the picked sector's first portal wall
+//     box x1 y1 x2 y2       add the vertices in a box around the picked sector's center
+//     drag dx dy            move the selection and snap it like a mouse drag
+//     split, merge, delete, snap, undo, redo
+//     floor d, ceil d       change the heights of the selected sectors
+// the link and faces columns are the time spent in setup_portals and relink_sectors, rebuilt counts sectors per call.
+
+#include "../src/editor.h"
+#include "../src/eye.h"
+#include "../src/map_renderer.h"
+#include "../src/mapgen.h"
+#include "../src/renderer2d.h"
+#include "../src/renderer3d.h"
+#include "bench_json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+
+
+// the editor draws through these, the bench never does
+Renderer2D  renderer2D;
+Renderer3D  renderer3D;
+Eye         eye;
+Editor      editor;
+MapRenderer renderer;
+
+
+static const char* default_script = R"(
+pick
+# move a corner shared by several sectors
+corner 0
+drag 0.5 0.5
+undo
+clear
+# split along the diagonal
+corner 0
+corner 2
+split
+undo
+clear
+# merge with the neighbour behind a portal
+portal
+merge
+undo
+clear
+corner 0
+floor 1
+ceil 1
+undo
+undo
+corner 0
+delete
+undo
+# a few rooms at once
+box -24 -24 24 24
+drag 1 0
+snap
+undo
+clear
+)";
+
+
+struct Command {
+    std::string name;
+    float       args[4];
+};
+
+
+struct Samples {
+    std::vector<double> ms;
+    int                 calls    = 0;
+    int                 rebuilt  = 0;
+    double              link_ms  = 0;
+    double              faces_ms = 0;
+};
+
+
+static bool parse_script(const std::string& text, std::vector<Command>& commands) {
+    std::istringstream lines(text);
+    std::string line;
+    int line_nr = 0;
+    while (std::getline(lines, line)) {
+        ++line_nr;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        Command c = {};
+        if (!(words >> c.name)) continue;
+        static const std::map<std::string, int> arg_counts = {
+            { "pick", 0 }, { "clear", 0 }, { "corner", 1 }, { "portal", 0 }, { "box", 4 }, { "drag", 2 },
+            { "split", 0 }, { "merge", 0 }, { "delete", 0 }, { "snap", 0 }, { "undo", 0 }, { "redo", 0 },
+            { "floor", 1 }, { "ceil", 1 },
+        };
+        auto it = arg_counts.find(c.name);
+        bool ok = it != arg_counts.end();
+        for (int i = 0; ok && i < it->second; ++i) ok = (bool) (words >> c.args[i]);
+        if (!ok) {
+            fprintf(stderr, "Error: script line %d: '%s'\n", line_nr, line.c_str());
+            return false;
+        }
+        commands.push_back(c);
+    }
+    return true;
+}
+
+
+// returns false for commands that only steer the macro and aren't timed
+static bool run(const Command& c, int sector_nr) {
+    const glm::vec2 eps(0.01f);
+    const Sector* s = sector_nr < (int) map.sectors.size() ? &map.sectors[sector_nr] : nullptr;
+    if (s && s->walls.empty()) s = nullptr;
+    if (c.name == "clear") {
+        editor.clear_selection();
+        return false;
+    }
+    if (c.name == "corner") {
+        if (!s) return true;
+        glm::vec2 p = s->walls[(int) c.args[0] % s->walls.size()].pos;
+        editor.select_box(p - eps, p + eps, true);
+    }
+    else if (c.name == "portal") {
+        if (!s) return true;
+        for (int j = 0; j < (int) s->walls.size(); ++j) {
+            if (s->walls[j].refs.size() != 1) continue;
+            glm::vec2 p1 = s->walls[j].pos;
+            glm::vec2 p2 = s->walls[(j + 1) % s->walls.size()].pos;
+            editor.select_box(p1 - eps, p1 + eps, true);
+            editor.select_box(p2 - eps, p2 + eps, true);
+            break;
+        }
+    }
+    else if (c.name == "box") {
+        if (!s) return true;
+        glm::vec2 center = (s->min + s->max) * 0.5f;
+        editor.select_box(center + glm::vec2(c.args[0], c.args[1]), center + glm::vec2(c.args[2], c.args[3]), true);
+    }
+    else if (c.name == "drag")   editor.drag_selection(glm::vec2(c.args[0], c.args[1]));
+    else if (c.name == "split")  editor.split_sector();
+    else if (c.name == "merge")  editor.merge_sectors();
+    else if (c.name == "delete") editor.delete_selection();
+    else if (c.name == "snap")   editor.snap_to_grid();
+    else if (c.name == "undo")   editor.undo(false);
+    else if (c.name == "redo")   editor.undo(true);
+    else if (c.name == "floor")  editor.change_heights(c.args[0], 0);
+    else if (c.name == "ceil")   editor.change_heights(0, c.args[0]);
+    return true;
+}
+
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    return sorted[std::min<size_t>(sorted.size() - 1, sorted.size() * p)];
+}
+
+
+int main(int argc, char** argv) {
+    int runs = 10;
+    std::string script = default_script;
+    const char* json_name = nullptr;
+    const char* baseline_name = nullptr;
+    double threshold = 25;
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-script") == 0 && i + 1 < argc) {
+            FILE* f = fopen(argv[++i], "rb");
+            if (!f) {
+                fprintf(stderr, "Error: can't open '%s'\n", argv[i]);
+                return 1;
+            }
+            script.clear();
+            char buffer[4096];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) script.append(buffer, n);
+            fclose(f);
+        }
+        else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc) json_name = argv[++i];
+        else if (strcmp(argv[i], "-baseline") == 0 && i + 1 < argc) baseline_name = argv[++i];
+        else if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]);
+        else if (atoi(argv[i]) > 0) sizes.push_back(atoi(argv[i]));
+        else {
+            fprintf(stderr, "usage: %s [-runs n] [-script file] [-json file] [-baseline file] [-threshold percent] "
+                    "[sectors...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (sizes.empty()) sizes = { 1000, 10000 };
+    std::vector<Command> commands;
+    if (!parse_script(script, commands)) return 1;
+
+    std::vector<Result> baseline;
+    if (baseline_name && !read_json(baseline_name, baseline)) {
+        fprintf(stderr, "Error: can't read '%s'\n", baseline_name);
+        return 1;
+    }
+    std::vector<Result> results;
+
+    for (int size : sizes) {
+        MapGenParams params;
+        params.sectors = size;
+        map.sectors.clear();
+        generate_map(params, map.sectors);
+        map.setup_portals();
+        editor.clear_selection();
+        int walls = 0;
+        for (const Sector& s : map.sectors) walls += s.walls.size();
+        printf("%d sectors, %d walls, %d runs\n", (int) map.sectors.size(), walls, runs);
+
+        std::map<std::string, Samples> samples;
+        std::mt19937 rng(size);
+        int sector_nr = 0;
+        for (int r = 0; r < runs; ++r) {
+            for (const Command& c : commands) {
+                if (c.name == "pick") {
+                    sector_nr = rng() % map.sectors.size();
+                    continue;
+                }
+                map.setup_stats = {};
+                auto start = std::chrono::steady_clock::now();
+                if (!run(c, sector_nr)) continue;
+                std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+                Samples& s = samples[c.name];
+                s.ms.push_back(ms.count());
+                s.calls    += map.setup_stats.calls;
+                s.rebuilt  += map.setup_stats.rebuilt_sectors;
+                s.link_ms  += map.setup_stats.link_ms;
+                s.faces_ms += map.setup_stats.faces_ms;
+            }
+        }
+
+        printf("%-8s %6s %9s %9s %9s %9s %9s %9s %8s\n",
+               "op", "count", "p50 ms", "p90 ms", "p99 ms", "max ms", "link ms", "faces ms", "rebuilt");
+        for (auto& it : samples) {
+            Samples& s = it.second;
+            std::sort(s.ms.begin(), s.ms.end());
+            int n = s.ms.size();
+            int calls = std::max(s.calls, 1);
+            printf("%-8s %6d %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %8.1f\n", it.first.c_str(), n,
+                   percentile(s.ms, 0.5), percentile(s.ms, 0.9), percentile(s.ms, 0.99), s.ms.back(),
+                   s.link_ms / n, s.faces_ms / n, (double) s.rebuilt / calls);
+            results.push_back({ it.first + "_p50", size, n, percentile(s.ms, 0.5) * 1e6 });
+            results.push_back({ it.first + "_p90", size, n, percentile(s.ms, 0.9) * 1e6 });
+        }
+        printf("\n");
+    }
+
+    if (json_name && !write_json(json_name, results)) {
+        fprintf(stderr, "Error: can't write '%s'\n", json_name);
+        return 1;
+    }
+    if (baseline_name && compare(baseline, results, threshold) > 0) return 1;
+    return 0;
+}
@@ -0,0 +1,405 @@
+// micro benchmarks of the core map algorithms on generated maps, no window or GPU needed
+//
+//     make bench
+//     bench/map_core [-json file] [-baseline file] [-threshold percent] [sectors...]
+//
+// maps of 1000, 10000 and 100000 sectors by default, all from the same seed.
+// -json writes the results, -baseline compares against results written earlier and
+// fails if anything got slower by more than -threshold percent, 10 by default.
+// save a baseline with: cp bench/results.json bench/baseline.json
+// before any timing, the map generator is checked against what mapgen.h promises
+// and relink_sectors against a full setup_portals.
+
+#include "../src/map.h"
+#include "../src/mapgen.h"
+#include "../src/map_text.h"
+#include "../src/math.h"
+#include "bench_json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+// each benchmark doubles its iterations until a run takes this long
+#ifndef BENCH_MIN_SECONDS
+#define BENCH_MIN_SECONDS 0.25
+#endif
+// and is then repeated, the fastest run counts
+#ifndef BENCH_REPEATS
+#define BENCH_REPEATS 3
+#endif
+
+
+static std::vector<Result> results;
+
+
+// f runs the given number of iterations, each one doing ops_per_iteration operations
+static void bench(const char* name, int sectors, const std::function<void(long long)>& f, int ops_per_iteration=1) {
+    auto run = [&f](long long n) {
+        auto start = std::chrono::steady_clock::now();
+        f(n);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    for (long long n = 1;; n *= 2) {
+        double s = run(n);
+        if (s < BENCH_MIN_SECONDS) continue;
+        // the fastest run is the one least disturbed by everything else on the machine
+        for (int i = 1; i < BENCH_REPEATS; ++i) s = std::min(s, run(n));
+        Result r = { name, sectors, n * ops_per_iteration, s * 1e9 / (n * ops_per_iteration) };
+        printf("%-20s %7d sectors %10lld ops %14.1f ns/op\n", name, sectors, r.iterations, r.ns_per_op);
+        fflush(stdout);
+        results.push_back(r);
+        return;
+    }
+}
+
+
+// random point inside a random sector, between floor and ceiling
+static Location random_location(std::mt19937& rng) {
+    for (;;) {
+        int nr = rng() % map.sectors.size();
+        const Sector& s = map.sectors[nr];
+        if (s.cells.empty()) continue;
+        // cells are convex, so any blend of their corners is inside
+        const SectorCell& cell = s.cells[rng() % s.cells.size()];
+        glm::vec2 p(0);
+        float total = 0;
+        for (const SectorCell::Edge& e : cell.edges) {
+            float w = 0.1f + rng() % 1000;
+            p += s.walls[e.vert_nr].pos * w;
+            total += w;
+        }
+        p /= total;
+        float y = glm::mix(s.floor_height, s.ceil_height, 0.5f);
+        return { glm::vec3(p.x, y, p.y), nr };
+    }
+}
+
+
+static glm::vec3 random_direction(std::mt19937& rng) {
+    float a = rng() % 10000 * (2 * M_PI / 10000);
+    float b = (rng() % 10000 / 10000.0f - 0.5f) * 0.5f;
+    return glm::vec3(cosf(a) * cosf(b), sinf(b), sinf(a) * cosf(b));
+}
+
+
+static void bench_map(int size) {
+    MapGenParams params;
+    params.sectors = size;
+    map.sectors.clear();
+    generate_map(params, map.sectors);
+    map.setup_portals();
+    int n = map.sectors.size();
+
+    std::mt19937 rng(size);
+    std::vector<Location> locs;
+    std::vector<glm::vec3> dirs;
+    for (int i = 0; i < 4096; ++i) {
+        locs.push_back(random_location(rng));
+        dirs.push_back(random_direction(rng));
+    }
+    volatile float sink = 0;
+
+    bench("ray_intersect", n, [&](long long iterations) {
+        for (long long i = 0; i < iterations; ++i) {
+            WallRef ref;
+            glm::vec3 normal;
+            sink = map.ray_intersect(locs[i & 4095], dirs[i & 4095] * 100.0f, ref, normal);
+        }
+    });
+
+    bench("clip_move", n, [&](long long iterations) {
+        for (long long i = 0; i < iterations; ++i) {
+            Location loc = locs[i & 4095];
+            map.clip_move(loc, dirs[i & 4095] * 2.0f);
+            sink = loc.pos.x;
+        }
+    });
+
+    bench("pick_sector", n, [&](long long iterations) {
+        for (long long i = 0; i < iterations; ++i) {
+            const glm::vec3& p = locs[i & 4095].pos;
+            sink = map.pick_sector(glm::vec2(p.x, p.z));
+        }
+    });
+
+    // positions nudged by up to a few units, so some of them left their sector
+    std::vector<Location> moved = locs;
+    for (Location& loc : moved) loc.pos += random_direction(rng) * glm::vec3(4, 0, 4);
+    bench("fix_sector", n, [&](long long iterations) {
+        for (long long i = 0; i < iterations; ++i) {
+            Location loc = moved[i & 4095];
+            sink = map.fix_sector(loc);
+        }
+    });
+
+    bench("triangulate", n, [&](long long iterations) {
+        std::vector<glm::vec2> poly;
+        for (long long i = 0; i < iterations; ++i) {
+            const Sector& s = map.sectors[i % n];
+            poly.clear();
+            for (const Wall& w : s.walls) poly.push_back(w.pos);
+            triangulate(poly, [&](const glm::vec2& a, const glm::vec2&, const glm::vec2&) { sink = a.x; });
+        }
+    });
+
+    // the faces are dropped again right away, so the arenas don't grow
+    bench("setup_sector_faces", n, [&](long long iterations) {
+        for (long long i = 0; i < iterations; ++i) {
+            Sector& s = map.sectors[i % n];
+            int first_face = s.first_face;
+            int face_count = s.face_count;
+            size_t face_size = map.faces.size();
+            size_t vert_size = map.verts.size();
+            map.setup_sector_faces(s);
+            map.faces.erase(map.faces.begin() + face_size, map.faces.end());
+            map.verts.erase(map.verts.begin() + vert_size, map.verts.end());
+            s.first_face = first_face;
+            s.face_count = face_count;
+        }
+    });
+
+    bench("setup_portals", n, [&](long long iterations) {
+        for (long long i = 0; i < iterations; ++i) {
+            for (Sector& s : map.sectors) s.face_count = 0;
+            map.setup_portals();
+        }
+    });
+
+    // what an edit costs: one sector changed
+    bench("setup_portals_one", n, [&](long long iterations) {
+        for (long long i = 0; i < iterations; ++i) {
+            map.sectors[i % n].face_count = 0;
+            map.setup_portals();
+        }
+    });
+
+    // the same through relink_sectors: a floor is raised and put back within each iteration,
+    // so the benches that follow see the map as it was
+    bench("relink_one", n, [&](long long iterations) {
+        for (long long i = 0; i < iterations; ++i) {
+            int nr = i % n;
+            map.sectors[nr].floor_height += 1;
+            map.relink_sectors({ nr });
+            map.sectors[nr].floor_height -= 1;
+            map.relink_sectors({ nr });
+        }
+    }, 2);
+
+    char name[] = "/tmp/map_core_XXXXXX";
+    int fd = mkstemp(name);
+    if (fd < 0 || close(fd) != 0 || !map.save(name)) {
+        fprintf(stderr, "Error: can't write '%s'\n", name);
+        return;
+    }
+    bench("load", n, [&](long long iterations) {
+        // keep the atlas stats printed by every load out of the results
+        fflush(stdout);
+        int out = dup(1);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        close(null);
+        for (long long i = 0; i < iterations; ++i) map.load(name);
+        fflush(stdout);
+        dup2(out, 1);
+        close(out);
+    });
+    unlink(name);
+}
+
+
+static void bench_atlas() {
+    // shadow map sized regions, the same ones every time
+    std::mt19937 rng(1);
+    std::vector<glm::ivec2> sizes;
+    for (int i = 0; i < 4096; ++i) sizes.emplace_back(2 + rng() % 62, 2 + rng() % 30);
+    bench("allocate_region", 0, [&](long long iterations) {
+        for (long long i = 0; i < iterations; ++i) {
+            Atlas atlas;
+            atlas.set_surface_size(1024);
+            atlas.init();
+            for (const glm::ivec2& s : sizes) atlas.allocate_region(s.x, s.y, true);
+        }
+    }, sizes.size());
+}
+
+
+// length of all walls with a portal, both sides counted
+static float portal_width(const MapGenParams& params) {
+    map.sectors.clear();
+    generate_map(params, map.sectors);
+    map.setup_portals();
+    float width = 0;
+    for (const Sector& s : map.sectors) {
+        for (int j = 0; j < (int) s.walls.size(); ++j) {
+            if (s.walls[j].refs.empty()) continue;
+            width += glm::distance(s.walls[j].pos, s.walls[(j + 1) % s.walls.size()].pos);
+        }
+    }
+    return width;
+}
+
+
+// the maps benchmarked have to be what the generator promises
+static bool check_mapgen() {
+    MapGenParams params;
+    params.sectors   = 400;
+    params.portals   = 1;
+    params.concavity = 0;
+    params.doors     = 0;
+    float open = portal_width(params);
+    params.doors     = 1;
+    float doors = portal_width(params);
+    if (doors >= open * 0.9f) {
+        fprintf(stderr, "Error: doors don't narrow the portals, %.1f with doors and %.1f without\n", doors, open);
+        return false;
+    }
+    params.sectors = 100;
+    params.stacked = 3;
+    map.sectors.clear();
+    generate_map(params, map.sectors);
+    if (map.sectors.size() != 100) {
+        fprintf(stderr, "Error: asked for 100 sectors, generated %d\n", (int) map.sectors.size());
+        return false;
+    }
+    return true;
+}
+
+
+// what a full setup_portals would have made of sector i
+static bool same_sector(const Map& a, const Map& b, int i) {
+    const Sector& sa = a.sectors[i];
+    const Sector& sb = b.sectors[i];
+    if (sa.walls.size() != sb.walls.size() || sa.cells.size() != sb.cells.size()) return false;
+    if (sa.face_key != sb.face_key || sa.face_count != sb.face_count) return false;
+    for (int j = 0; j < (int) sa.walls.size(); ++j) {
+        if (sa.walls[j].pos != sb.walls[j].pos || sa.walls[j].refs != sb.walls[j].refs) return false;
+    }
+    for (int c = 0; c < (int) sa.cells.size(); ++c) {
+        const std::vector<SectorCell::Edge>& ea = sa.cells[c].edges;
+        const std::vector<SectorCell::Edge>& eb = sb.cells[c].edges;
+        if (ea.size() != eb.size()) return false;
+        for (int e = 0; e < (int) ea.size(); ++e) {
+            if (ea[e].vert_nr != eb[e].vert_nr || ea[e].wall_nr != eb[e].wall_nr || ea[e].cell_nr != eb[e].cell_nr) {
+                return false;
+            }
+        }
+    }
+    Span<const MapFace> fa = a.get_faces(sa);
+    Span<const MapFace> fb = b.get_faces(sb);
+    for (int f = 0; f < sa.face_count; ++f) {
+        Span<const MapVertex> va = a.get_verts(fa[f]);
+        Span<const MapVertex> vb = b.get_verts(fb[f]);
+        if (va.size() != vb.size()) return false;
+        for (int v = 0; v < (int) va.size(); ++v) {
+            if (va[v].pos != vb[v].pos || va[v].uv != vb[v].uv) return false;
+        }
+    }
+    return true;
+}
+
+
+// relink_sectors has to end up where a full setup_portals does.
+// random height changes and moves of vertices shared by several sectors go through relink_sectors
+// on map and through setup_portals on a copy of the sectors
+static bool check_relink() {
+    MapGenParams params;
+    params.sectors = 400;
+    params.stacked = 0.3f;
+    map.sectors.clear();
+    generate_map(params, map.sectors);
+    map.setup_portals();
+    std::unique_ptr<Map> full(new Map);
+    full->sectors.clear();
+    generate_map(params, full->sectors);
+    full->setup_portals();
+
+    std::mt19937 rng(1);
+    for (int edit = 0; edit < 300; ++edit) {
+        int nr = rng() % map.sectors.size();
+        Sector& s = map.sectors[nr];
+        if (s.walls.size() < 3) continue;
+        std::vector<int> changed;
+        if (rng() % 2) {
+            s.floor_height += (int) (rng() % 7) - 3;
+            s.ceil_height  += (int) (rng() % 7) - 3;
+            if (s.ceil_height <= s.floor_height) s.ceil_height = s.floor_height + 1;
+            changed.push_back(nr);
+        }
+        else {
+            // every vertex on top of the picked one moves along, now and then onto the next vertex
+            int j = rng() % s.walls.size();
+            glm::vec2 from = s.walls[j].pos;
+            glm::vec2 to = from + glm::vec2((int) (rng() % 5) - 2, (int) (rng() % 5) - 2);
+            if (rng() % 8 == 0) to = s.walls[(j + 1) % s.walls.size()].pos;
+            for (int i = 0; i < (int) map.sectors.size(); ++i) {
+                for (Wall& w : map.sectors[i].walls) {
+                    if (w.pos != from) continue;
+                    w.pos = to;
+                    changed.push_back(i);
+                }
+            }
+        }
+        for (int i : changed) {
+            const Sector& from = map.sectors[i];
+            Sector& to = full->sectors[i];
+            to.walls.resize(from.walls.size());
+            for (int j = 0; j < (int) from.walls.size(); ++j) to.walls[j].pos = from.walls[j].pos;
+            to.floor_height = from.floor_height;
+            to.ceil_height  = from.ceil_height;
+        }
+        map.relink_sectors(changed);
+        full->setup_portals();
+        for (int i = 0; i < (int) map.sectors.size(); ++i) {
+            if (same_sector(map, *full, i)) continue;
+            fprintf(stderr, "Error: edit %d: sector %d differs from a full setup_portals\n", edit, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char** argv) {
+    const char* json_name = nullptr;
+    const char* baseline_name = nullptr;
+    double threshold = 10;
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-json") == 0 && i + 1 < argc) json_name = argv[++i];
+        else if (strcmp(argv[i], "-baseline") == 0 && i + 1 < argc) baseline_name = argv[++i];
+        else if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]);
+        else if (atoi(argv[i]) > 0) sizes.push_back(atoi(argv[i]));
+        else {
+            fprintf(stderr, "usage: %s [-json file] [-baseline file] [-threshold percent] [sectors...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (sizes.empty()) sizes = { 1000, 10000, 100000 };
+
+    std::vector<Result> baseline;
+    if (baseline_name && !read_json(baseline_name, baseline)) {
+        fprintf(stderr, "Error: can't read '%s'\n", baseline_name);
+        return 1;
+    }
+
+    if (!check_mapgen() || !check_relink()) return 1;
+    bench_atlas();
+    for (int size : sizes) bench_map(size);
+
+    if (json_name && !write_json(json_name, results)) {
+        fprintf(stderr, "Error: can't write '%s'\n", json_name);
+        return 1;
+    }
+    if (baseline_name && compare(baseline, results, threshold) > 0) return 1;
+    return 0;
+}
@@ -0,0 +1,80 @@
+// throughput of the text map reader and writer on a large generated map
+//
+//     make bench
+//     bench/map_text 500      size in MB, 200 by default
+
+#include "../src/map_text.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+
+// rooms of varying size with fractional coordinates, a few of them with very long wall lines
+static std::vector<Sector> generate(size_t bytes) {
+    std::vector<Sector> sectors;
+    size_t size = 0;
+    while (size < bytes) {
+        sectors.emplace_back();
+        Sector& s = sectors.back();
+        int n = sectors.size() % 100 == 0 ? 5000 : 4 + rand() % 40;
+        glm::vec2 center(rand() % 100000 / 10.0f, rand() % 100000 / 10.0f);
+        for (int i = 0; i < n; ++i) {
+            float a = -i * 2 * M_PI / n;
+            float r = 5 + rand() % 1000 / 37.0f;
+            s.walls.push_back({ center + glm::vec2(cosf(a), sinf(a)) * r });
+        }
+        s.floor_height = rand() % 64 / 4.0f;
+        s.ceil_height  = s.floor_height + 8 + rand() % 64 / 4.0f;
+        size += n * 20 + 12;
+    }
+    return sectors;
+}
+
+
+static bool equal(const std::vector<Sector>& a, const std::vector<Sector>& b) {
+    if (a.size() != b.size()) return false;
+    for (int i = 0; i < (int) a.size(); ++i) {
+        if (a[i].floor_height != b[i].floor_height || a[i].ceil_height != b[i].ceil_height) return false;
+        if (a[i].walls.size() != b[i].walls.size()) return false;
+        for (int j = 0; j < (int) a[i].walls.size(); ++j) {
+            if (a[i].walls[j].pos != b[i].walls[j].pos) return false;
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char** argv) {
+    size_t mb = argc > 1 ? atoi(argv[1]) : 200;
+    srand(0);
+    std::vector<Sector> sectors = generate(mb << 20);
+
+    FILE* f = tmpfile();
+    if (!f) return 1;
+
+    auto t0 = std::chrono::steady_clock::now();
+    write_map_text(f, sectors);
+    fflush(f);
+    auto t1 = std::chrono::steady_clock::now();
+    double size = ftell(f) / double(1 << 20);
+    rewind(f);
+
+    std::vector<Sector> loaded;
+    MapTextError error;
+    bool ok = read_map_text(f, loaded, error);
+    auto t2 = std::chrono::steady_clock::now();
+    fclose(f);
+    if (!ok) {
+        printf("error at %d:%d: %s\n", error.line, error.column, error.message);
+        return 1;
+    }
+
+    double write_s = std::chrono::duration<double>(t1 - t0).count();
+    double read_s  = std::chrono::duration<double>(t2 - t1).count();
+    printf("%d sectors, %.1f MB\n", (int) sectors.size(), size);
+    printf("write %8.1f ms  %7.1f MB/s\n", write_s * 1000, size / write_s);
+    printf("read  %8.1f ms  %7.1f MB/s\n", read_s * 1000, size / read_s);
+    printf("round trip %s\n", equal(sectors, loaded) ? "exact" : "MISMATCH");
+    return equal(sectors, loaded) ? 0 : 1;
+}
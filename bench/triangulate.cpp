@@ -0,0 +1,87 @@
+// triangulation of large generated polygons
+//
+//     make bench
+
+#include "../src/math.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+
+// star shaped, about half of the vertices are reflex
+static std::vector<glm::vec2> star(int n) {
+    std::vector<glm::vec2> poly;
+    for (int i = 0; i < n; ++i) {
+        float a = -i * 2 * M_PI / n;
+        float r = 50 + rand() % 50;
+        poly.emplace_back(glm::vec2(cosf(a), sinf(a)) * r);
+    }
+    return poly;
+}
+
+// long teeth, every ear test sees many reflex vertices with a naive search
+static std::vector<glm::vec2> comb(int n) {
+    std::vector<glm::vec2> poly;
+    int teeth = n / 4;
+    for (int i = 0; i < teeth; ++i) {
+        poly.emplace_back(i * 2,     0);
+        poly.emplace_back(i * 2,     100);
+        poly.emplace_back(i * 2 + 1, 100);
+        poly.emplace_back(i * 2 + 1, 1);
+    }
+    poly.emplace_back(teeth * 2, 0);
+    poly.emplace_back(teeth * 2, -1);
+    poly.emplace_back(0, -1);
+    return poly;
+}
+
+// a square with collinear and duplicate points along its edges
+static std::vector<glm::vec2> square(int n) {
+    std::vector<glm::vec2> poly;
+    int side = n / 4;
+    glm::vec2 corners[] = { { 0, 0 }, { 0, 100 }, { 100, 100 }, { 100, 0 } };
+    for (int c = 0; c < 4; ++c) {
+        for (int i = 0; i < side; ++i) {
+            glm::vec2 p = glm::mix(corners[c], corners[(c + 1) % 4], i / float(side));
+            poly.push_back(p);
+            if (i % 7 == 0) poly.push_back(p);
+        }
+    }
+    return poly;
+}
+
+
+static float polygon_area(const std::vector<glm::vec2>& poly) {
+    float area = 0;
+    for (int i = 0; i < (int) poly.size(); ++i) area += cross(poly[i], poly[(i + 1) % poly.size()]);
+    return std::abs(area) / 2;
+}
+
+
+static void run(const char* name, const std::vector<glm::vec2>& poly) {
+    int triangles = 0;
+    double area = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    bool ok = triangulate(poly, [&](const glm::vec2& a, const glm::vec2& b, const glm::vec2& c) {
+        ++triangles;
+        area += cross(c - a, b - a) / 2;
+    });
+    auto t1 = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    printf("%-8s %7d vertices %10.3f ms  %7d triangles  area error %.4f%s\n",
+           name, (int) poly.size(), ms, triangles,
+           std::abs(area - polygon_area(poly)) / polygon_area(poly),
+           ok ? "" : "  (forced)");
+}
+
+
+int main() {
+    srand(0);
+    for (int n : { 100, 1000, 10000, 100000 }) {
+        run("star", star(n));
+        run("comb", comb(n));
+        run("square", square(n));
+    }
+    return 0;
+}
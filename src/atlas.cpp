@@ -1,102 +1,422 @@
 #include "atlas.h"
 #include <assert.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
-#include <glm/glm.hpp>
-
-
-Atlas::~Atlas() {
-    for (SDL_Surface* s : m_surfaces) SDL_FreeSurface(s);
-}
 
 
 void Atlas::init() {
-    for (SDL_Surface* s : m_surfaces) SDL_FreeSurface(s);
     m_surfaces.clear();
+    m_used_texels = 0;
     m_surface_loaded = false;
-    for (int& i : m_columns) i = 0;
 }
 
-bool Atlas::load_surface(const char* name) {
+
+bool Atlas::load_surface(const char* name, std::vector<uint8_t>& texels) const {
+    texels.resize(m_surface_size * m_surface_size * get_bytes_per_texel());
+
+    if (m_format == Format::R16) {
+        FILE* f = fopen(name, "rb");
+        if (!f) return false;
+        char magic[4];
+        uint32_t size;
+        bool ok = fread(magic, 4, 1, f) == 1 && memcmp(magic, "SM16", 4) == 0
+               && fread(&size, 4, 1, f) == 1 && (int) size == m_surface_size
+               && fread(texels.data(), texels.size(), 1, f) == 1;
+        fclose(f);
+        return ok;
+    }
+
     SDL_Surface* s = IMG_Load(name);
     if (!s) return false;
     SDL_Surface* t = SDL_ConvertSurfaceFormat(s, SDL_PIXELFORMAT_RGB24, 0);
     SDL_FreeSurface(s);
-    init();
-    m_surfaces.push_back(t);
+    if (!t) return false;
+    if (t->w != m_surface_size || t->h != m_surface_size) {
+        SDL_FreeSurface(t);
+        return false;
+    }
+    // older caches are rgb, all channels hold the same value
+    for (int y = 0; y < m_surface_size; ++y)
+    for (int x = 0; x < m_surface_size; ++x) {
+        texels[y * m_surface_size + x] = ((uint8_t*) t->pixels)[y * t->pitch + x * 3];
+    }
+    SDL_FreeSurface(t);
+    return true;
+}
+
+
+bool Atlas::load_surfaces(const char* name) {
+    std::vector<std::vector<uint8_t>> texels(m_surfaces.size());
+    for (int i = 0; i < (int) m_surfaces.size(); ++i) {
+        char filename[256];
+        snprintf(filename, sizeof(filename), name, i);
+        if (!load_surface(filename, texels[i])) return false;
+    }
+    for (int i = 0; i < (int) m_surfaces.size(); ++i) {
+        m_surfaces[i].texels = std::move(texels[i]);
+        mark_dirty(i, { 0, 0, m_surface_size, m_surface_size });
+    }
     m_surface_loaded = true;
-    for (int& i : m_columns) i = 0;
     return true;
 }
 
+
 void Atlas::add_surface() {
-    SDL_Surface* s = SDL_CreateRGBSurface(0, SURFACE_SIZE, SURFACE_SIZE, 24, 0, 0, 0, 0);
-    m_surfaces.push_back(s);
-    for (int& i : m_columns) i = 0;
-    memset(s->pixels, 0xff, s->h * s->pitch);
+    m_surfaces.emplace_back();
+    Surface& s = m_surfaces.back();
+    s.texels.resize(m_surface_size * m_surface_size * get_bytes_per_texel(), 0xff);
+    s.free_rects.push_back({ 0, 0, m_surface_size, m_surface_size });
+    s.dirty = { 0, 0, m_surface_size, m_surface_size };
+}
+
+
+void Atlas::mark_dirty(int surface_nr, const Rect& r) {
+    Rect& d = m_surfaces[surface_nr].dirty;
+    if (d.w == 0) {
+        d = r;
+        return;
+    }
+    int x1 = std::max(d.x + d.w, r.x + r.w);
+    int y1 = std::max(d.y + d.h, r.y + r.h);
+    d.x = std::min(d.x, r.x);
+    d.y = std::min(d.y, r.y);
+    d.w = x1 - d.x;
+    d.h = y1 - d.y;
+}
+
+
+void Atlas::clear_dirty() {
+    for (Surface& s : m_surfaces) s.dirty = { 0, 0, 0, 0 };
 }
 
 
-AtlasRegion Atlas::allocate_region(int w, int h) {
-    assert(w <= SURFACE_SIZE || h <= SURFACE_SIZE);
+void Atlas::find_position(int surface_nr, int w, int h, bool allow_rotation,
+                          AtlasRegion& best, int& best_short, int& best_long) const {
+    for (const Rect& f : m_surfaces[surface_nr].free_rects) {
+        for (int rot = 0; rot <= (int) allow_rotation; ++rot) {
+            int rw = rot ? h : w;
+            int rh = rot ? w : h;
+            if (rw > f.w || rh > f.h) continue;
+            int short_side = std::min(f.w - rw, f.h - rh);
+            int long_side  = std::max(f.w - rw, f.h - rh);
+            if (short_side < best_short || (short_side == best_short && long_side < best_long)) {
+                best_short      = short_side;
+                best_long       = long_side;
+                best.surface_nr = surface_nr;
+                best.x          = f.x;
+                best.y          = f.y;
+                best.w          = rw;
+                best.h          = rh;
+                best.rotated    = rot;
+            }
+        }
+    }
+}
 
-    if (m_surfaces.empty()) add_surface();
 
-    bool found = false;
+static bool intersects(const Atlas::Rect& a, const Atlas::Rect& b) {
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+static bool contains(const Atlas::Rect& a, const Atlas::Rect& b) {
+    return b.x >= a.x && b.y >= a.y && b.x + b.w <= a.x + a.w && b.y + b.h <= a.y + a.h;
+}
 
-    int xx = 0;
-    int yy = SURFACE_SIZE - h;
 
-    for (int x = 0; x < SURFACE_SIZE - w;) {
-        int y = 0;
-        for (int i = 0; i < w; ++i) {
-            y = std::max(y, m_columns[x + i]);
-            if (y >= yy) break;
+void Atlas::split_free_rects(Surface& s, const Rect& used) {
+    std::vector<Rect> new_rects;
+    for (int i = 0; i < (int) s.free_rects.size();) {
+        Rect f = s.free_rects[i];
+        if (!intersects(f, used)) {
+            ++i;
+            continue;
         }
-        if (y < yy) {
-            yy = y;
-            xx = x;
-            found = true;
+        // the parts of f left, right, above and below the used rect
+        if (used.x > f.x) new_rects.push_back({ f.x, f.y, used.x - f.x, f.h });
+        if (used.x + used.w < f.x + f.w) new_rects.push_back({ used.x + used.w, f.y, f.x + f.w - used.x - used.w, f.h });
+        if (used.y > f.y) new_rects.push_back({ f.x, f.y, f.w, used.y - f.y });
+        if (used.y + used.h < f.y + f.h) new_rects.push_back({ f.x, used.y + used.h, f.w, f.y + f.h - used.y - used.h });
+        s.free_rects[i] = s.free_rects.back();
+        s.free_rects.pop_back();
+    }
+
+    // keep only maximal rects
+    // new rects are parts of old ones, so no old rect can be contained in a new one
+    int old_count = s.free_rects.size();
+    for (int i = 0; i < (int) new_rects.size(); ++i) {
+        const Rect& n = new_rects[i];
+        bool redundant = false;
+        for (int j = 0; j < old_count && !redundant; ++j) redundant = contains(s.free_rects[j], n);
+        for (int j = 0; j < (int) new_rects.size() && !redundant; ++j) {
+            if (j == i || !contains(new_rects[j], n)) continue;
+            // of two equal rects drop the later one
+            redundant = !contains(n, new_rects[j]) || j < i;
         }
-        ++x;
-        while (x < SURFACE_SIZE - w && m_columns[x - 1] == m_columns[x]) ++x;
+        if (!redundant) s.free_rects.push_back(n);
     }
+}
 
-    assert(found);
-    for (int x = 0; x < w; ++x) m_columns[xx + x] = yy + h;
+
+AtlasRegion Atlas::allocate(int w, int h, bool allow_rotation, int first_surface) {
+    assert(w <= m_surface_size && h <= m_surface_size);
 
     AtlasRegion r;
-    r.surface_nr = m_surfaces.size() - 1;
-    r.x = xx;
-    r.y = yy;
-    r.w = w;
-    r.h = h;
-
-
-    if (!m_surface_loaded) {
-        // fill region with random color
-        glm::u8vec3 color;
-        color.r = rand() % 256;
-        color.g = rand() % 256;
-        color.b = rand() % 256;
-        SDL_Surface* s = m_surfaces.back();
-        for (int x = r.x; x < r.x + r.w; ++x)
-        for (int y = r.y; y < r.y + r.h; ++y) {
-            glm::u8vec3& p = *(glm::u8vec3 *) ((uint8_t * ) s->pixels + y * s->pitch + x * sizeof(glm::u8vec3));
-            if (x == r.x || x == r.x + r.w - 1 || y == r.y || y == r.y + r.h - 1) {
-                p = color;
-            }
-            else if ((x ^ y) & 1) p = color;
-            else p = glm::u8vec3(255, 255, 255);
+    r.surface_nr = -1;
+    int best_short = m_surface_size + 1;
+    int best_long  = m_surface_size + 1;
+    for (int i = first_surface; i < (int) m_surfaces.size(); ++i) {
+        find_position(i, w, h, allow_rotation, r, best_short, best_long);
+    }
+    if (r.surface_nr == -1) {
+        add_surface();
+        find_position(m_surfaces.size() - 1, w, h, allow_rotation, r, best_short, best_long);
+        assert(r.surface_nr != -1);
+    }
+    insert_region(r);
+    return r;
+}
+
+
+void Atlas::insert_region(const AtlasRegion& r) {
+    Surface& s = m_surfaces[r.surface_nr];
+    split_free_rects(s, { r.x, r.y, r.w, r.h });
+    s.regions.push_back(r);
+    s.used_texels += r.w * r.h;
+    m_used_texels += r.w * r.h;
+}
+
+
+void Atlas::fill_region(const AtlasRegion& r) {
+    if (m_surface_loaded) {
+        // no baked data for new regions, leave them unshadowed
+        for (int x = 0; x < r.w; ++x)
+        for (int y = 0; y < r.h; ++y) set_texel(r, x, y, 1);
+        return;
+    }
+
+    // fill region with random shade
+    float shade = rand() % 256 / 255.0f;
+    for (int x = 0; x < r.w; ++x)
+    for (int y = 0; y < r.h; ++y) {
+        if (x == 0 || x == r.w - 1 || y == 0 || y == r.h - 1) {
+            set_texel(r, x, y, shade);
         }
+        else if (((r.x + x) ^ (r.y + y)) & 1) set_texel(r, x, y, shade);
+        else set_texel(r, x, y, 1);
     }
+}
+
 
+AtlasRegion Atlas::allocate_region(int w, int h, bool allow_rotation) {
+    AtlasRegion r = allocate(w, h, allow_rotation, 0);
+    fill_region(r);
     return r;
 }
 
 
-void Atlas::save() {
+bool Atlas::place(const std::vector<AtlasRegion>& regions) {
+    init();
+    // surfaces only get added for regions that fit nowhere else, so a layout with more empty
+    // surfaces than used ones is taken as corrupt before any of them gets allocated
+    std::vector<bool> used;
+    for (const AtlasRegion& r : regions) {
+        if (r.surface_nr < 0 || r.surface_nr >= (int) regions.size()) return false;
+        if (r.surface_nr >= (int) used.size()) used.resize(r.surface_nr + 1);
+        used[r.surface_nr] = true;
+    }
+    if (used.size() > 2 * (size_t) std::count(used.begin(), used.end(), true)) return false;
+
+    for (const AtlasRegion& r : regions) {
+        if (r.x < 0 || r.y < 0 || r.w <= 0 || r.h <= 0
+        ||  r.x + r.w > m_surface_size || r.y + r.h > m_surface_size) {
+            init();
+            return false;
+        }
+        while (r.surface_nr >= (int) m_surfaces.size()) add_surface();
+        insert_region(r);
+    }
+    return true;
+}
+
+
+void Atlas::merge_free_rects(Surface& s) {
+    // only the new rect is compared against the others. every time it grows the scan starts over,
+    // so a free costs the number of free rects times one more than the merges it makes.
+    // that is quadratic at worst, but no longer compares every pair of rects each time
+    std::vector<Rect>& rects = s.free_rects;
+    Rect a = rects.back();
+    rects.pop_back();
+    for (int j = 0; j < (int) rects.size(); ++j) {
+        const Rect& b = rects[j];
+        if (contains(b, a)) return;
+        bool grown = false;
+        if (contains(a, b)) {}
+        else if (a.x == b.x && a.w == b.w && (a.y + a.h == b.y || b.y + b.h == a.y)) {
+            a.y = std::min(a.y, b.y);
+            a.h += b.h;
+            grown = true;
+        }
+        else if (a.y == b.y && a.h == b.h && (a.x + a.w == b.x || b.x + b.w == a.x)) {
+            a.x = std::min(a.x, b.x);
+            a.w += b.w;
+            grown = true;
+        }
+        else continue;
+        rects[j] = rects.back();
+        rects.pop_back();
+        // a grown rect may now merge with rects it was already compared to
+        j = grown ? -1 : j - 1;
+    }
+    rects.push_back(a);
+}
+
+
+void Atlas::free_region(const AtlasRegion& r) {
+    Surface& s = m_surfaces[r.surface_nr];
+    auto it = std::find_if(s.regions.begin(), s.regions.end(), [&r](const AtlasRegion& q) {
+        return q.x == r.x && q.y == r.y;
+    });
+    assert(it != s.regions.end());
+    *it = s.regions.back();
+    s.regions.pop_back();
+    s.used_texels -= r.w * r.h;
+    m_used_texels -= r.w * r.h;
+
+    if (s.regions.empty()) {
+        s.free_rects = { { 0, 0, m_surface_size, m_surface_size } };
+        return;
+    }
+    s.free_rects.push_back({ r.x, r.y, r.w, r.h });
+    merge_free_rects(s);
+}
+
+
+bool Atlas::defragment(int max_moves, const std::function<void(const AtlasRegion&, const AtlasRegion&)>& moved) {
+    // drop trailing empty surfaces
+    bool changed = false;
+    while (!m_surfaces.empty() && m_surfaces.back().regions.empty()) {
+        m_surfaces.pop_back();
+        changed = true;
+    }
+    if (m_surfaces.size() < 2) return changed;
+
+    int src = 0;
+    for (int i = 1; i < (int) m_surfaces.size(); ++i) {
+        if (m_surfaces[i].used_texels < m_surfaces[src].used_texels) src = i;
+    }
+
+    for (int k = 0; k < max_moves && !m_surfaces[src].regions.empty(); ++k) {
+        AtlasRegion from = m_surfaces[src].regions.back();
+
+        AtlasRegion to;
+        to.surface_nr = -1;
+        int best_short = m_surface_size + 1;
+        int best_long  = m_surface_size + 1;
+        for (int i = 0; i < (int) m_surfaces.size(); ++i) {
+            if (i != src) find_position(i, from.w, from.h, false, to, best_short, best_long);
+        }
+        // no room on other surfaces
+        if (to.surface_nr == -1) break;
+        // orientation is kept so the face's bake matrix stays valid
+        to.rotated = from.rotated;
+        insert_region(to);
+
+        int row = from.w * get_bytes_per_texel();
+        for (int y = 0; y < from.h; ++y) {
+            memcpy(texel_ptr(to.surface_nr, to.x, to.y + y), texel_ptr(from.surface_nr, from.x, from.y + y), row);
+        }
+        mark_dirty(to.surface_nr, { to.x, to.y, to.w, to.h });
+        free_region(from);
+        moved(from, to);
+        changed = true;
+    }
+
+    while (!m_surfaces.empty() && m_surfaces.back().regions.empty()) m_surfaces.pop_back();
+    return changed;
+}
+
+
+void Atlas::pack(std::vector<AtlasRegion>& regions) {
+    // sort by area, then by longest side
+    std::vector<int> order(regions.size());
+    for (int i = 0; i < (int) order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&regions](int a, int b) {
+        const AtlasRegion& ra = regions[a];
+        const AtlasRegion& rb = regions[b];
+        if (ra.w * ra.h != rb.w * rb.h) return ra.w * ra.h > rb.w * rb.h;
+        return std::max(ra.w, ra.h) > std::max(rb.w, rb.h);
+    });
+    for (int i : order) {
+        int first = std::max(0, (int) m_surfaces.size() - MAX_OPEN_SURFACES);
+        regions[i] = allocate(regions[i].w, regions[i].h, true, first);
+        fill_region(regions[i]);
+    }
+}
+
+
+Atlas::Stats Atlas::get_stats() const {
+    Stats stats;
+    long long total = (long long) m_surfaces.size() * m_surface_size * m_surface_size;
+    stats.surface_count = m_surfaces.size();
+    stats.used_texels   = m_used_texels;
+    stats.wasted_texels = total - m_used_texels;
+    stats.occupancy     = total ? 100.0f * m_used_texels / total : 0;
+    return stats;
+}
+
+
+float Atlas::get_texel(const AtlasRegion& r, int x, int y) const {
+    const uint8_t* p = texel_ptr(r.surface_nr, r.x + x, r.y + y);
+    if (m_format == Format::R16) return *(const uint16_t*) p / 65535.0f;
+    return *p / 255.0f;
+}
+
+void Atlas::set_texel(const AtlasRegion& r, int x, int y, float v) {
+    uint8_t* p = texel_ptr(r.surface_nr, r.x + x, r.y + y);
+    mark_dirty(r.surface_nr, { r.x + x, r.y + y, 1, 1 });
+    v = std::max(0.0f, std::min(1.0f, v));
+    if (m_format == Format::R16) *(uint16_t*) p = v * 65535 + 0.5f;
+    else *p = v * 255 + 0.5f;
+}
+
+void Atlas::read_region(const AtlasRegion& r, void* data) const {
+    int row = r.w * get_bytes_per_texel();
+    for (int y = 0; y < r.h; ++y) memcpy((uint8_t*) data + y * row, texel_ptr(r.surface_nr, r.x, r.y + y), row);
+}
+
+void Atlas::write_region(const AtlasRegion& r, const void* data) {
+    int row = r.w * get_bytes_per_texel();
+    for (int y = 0; y < r.h; ++y) memcpy(texel_ptr(r.surface_nr, r.x, r.y + y), (const uint8_t*) data + y * row, row);
+    mark_dirty(r.surface_nr, { r.x, r.y, r.w, r.h });
+}
+
+
+
+void Atlas::save(const char* name) const {
     for (int i = 0; i < (int) m_surfaces.size(); ++i) {
-        IMG_SavePNG(m_surfaces[i], "sm.png");
+        char filename[256];
+        snprintf(filename, sizeof(filename), name, i);
+        const std::vector<uint8_t>& texels = m_surfaces[i].texels;
+        if (m_format == Format::R16) {
+            FILE* f = fopen(filename, "wb");
+            if (!f) return;
+            uint32_t size = m_surface_size;
+            fwrite("SM16", 4, 1, f);
+            fwrite(&size, 4, 1, f);
+            fwrite(texels.data(), texels.size(), 1, f);
+            fclose(f);
+        }
+        else {
+            SDL_Surface* s = SDL_CreateRGBSurfaceWithFormatFrom((void*) texels.data(),
+                    m_surface_size, m_surface_size, 8, m_surface_size, SDL_PIXELFORMAT_INDEX8);
+            SDL_Color gray[256];
+            for (int j = 0; j < 256; ++j) gray[j] = { uint8_t(j), uint8_t(j), uint8_t(j), 255 };
+            SDL_SetPaletteColors(s->format->palette, gray, 0, 256);
+            IMG_SavePNG(s, filename);
+            SDL_FreeSurface(s);
+        }
     }
 }
@@ -1,8 +1,8 @@
 #pragma once
 
-#include <SDL2/SDL.h>
+#include <cstdint>
 #include <vector>
-#include <array>
+#include <functional>
 
 
 
@@ -12,24 +12,109 @@ struct AtlasRegion {
 	int y;
 	int w;
 	int h;
+	// region is stored transposed, local x runs along the atlas y axis
+	bool rotated = false;
 };
 
 
 class Atlas {
 public:
-	enum { SURFACE_SIZE = 512 };
+	enum { DEFAULT_SURFACE_SIZE = 512 };
+
+	// only the newest surfaces are searched by pack()
+	enum { MAX_OPEN_SURFACES = 4 };
+
+	// single channel surfaces, R16 avoids banding in high quality bakes
+	enum class Format { R8, R16 };
+
+	struct Stats {
+		int			surface_count;
+		long long	used_texels;
+		long long	wasted_texels;
+		float		occupancy;
+	};
+
+	void			set_format(Format format) { m_format = format; }
+	Format			get_format() const { return m_format; }
+	int				get_bytes_per_texel() const { return m_format == Format::R16 ? 2 : 1; }
+
+	// takes effect on the next init()
+	void			set_surface_size(int size) { m_surface_size = size; }
+	int				get_surface_size() const { return m_surface_size; }
+	int				get_surface_count() const { return m_surfaces.size(); }
+	Stats			get_stats() const;
 
-	~Atlas();
 	void			init();
-	AtlasRegion		allocate_region(int w, int h);
-	bool			load_surface(const char* name);
-	void			save();
+	// best short side fit over all surfaces,
+	// spills onto a new surface when the region doesn't fit into any of them
+	AtlasRegion		allocate_region(int w, int h, bool allow_rotation=false);
+	// place all regions at once, largest first, only the newest surfaces are searched
+	// w and h of each region are its unrotated size and get swapped for rotated regions
+	void			pack(std::vector<AtlasRegion>& regions);
+	// re-create the allocations of a saved layout, texels are left untouched.
+	// fails if a region doesn't fit the surface size or the layout has more empty surfaces than used ones
+	bool			place(const std::vector<AtlasRegion>& regions);
+	// the freed rect is merged with adjacent free rects
+	void			free_region(const AtlasRegion& r);
+	// move up to max_moves regions off the emptiest surface, trailing empty surfaces are dropped
+	// moved is called with the old and new region for every move
+	// returns false when nothing could be moved
+	bool			defragment(int max_moves, const std::function<void(const AtlasRegion&, const AtlasRegion&)>& moved);
+
+	float			get_texel(const AtlasRegion& r, int x, int y) const;
+	void			set_texel(const AtlasRegion& r, int x, int y, float v);
+	const void*		get_surface_data(int nr) const { return m_surfaces[nr].texels.data(); }
+	// raw texels of a region as laid out in the atlas, r.w * r.h * get_bytes_per_texel() bytes
+	void			read_region(const AtlasRegion& r, void* data) const;
+	void			write_region(const AtlasRegion& r, const void* data);
+
+	struct Rect {
+		int x;
+		int y;
+		int w;
+		int h;
+	};
+
+	// bounding rect of the texels changed since the last clear_dirty(), w is 0 if there are none
+	const Rect&		get_dirty_rect(int nr) const { return m_surfaces[nr].dirty; }
+	void			clear_dirty();
+
+	// one file per surface, name is a printf pattern taking the surface number
+	// R8 surfaces are cached as grayscale png, R16 surfaces as raw little-endian data
+	bool			load_surfaces(const char* name);
+	void			save(const char* name) const;
 
 //private:
 
-	std::vector<SDL_Surface*>			m_surfaces;
-	std::array<int, SURFACE_SIZE>		m_columns;
-	bool								m_surface_loaded = false;
+	struct Surface {
+		std::vector<uint8_t>	texels;
+		std::vector<Rect>		free_rects;	// free rectangles, may overlap
+		std::vector<AtlasRegion>	regions;	// allocated regions
+		long long				used_texels = 0;
+		Rect					dirty = { 0, 0, 0, 0 };
+	};
+
+	Format					m_format = Format::R8;
+	int						m_surface_size = DEFAULT_SURFACE_SIZE;
+	std::vector<Surface>	m_surfaces;
+	long long				m_used_texels = 0;
+	bool					m_surface_loaded = false;
 
+	uint8_t* texel_ptr(int surface_nr, int x, int y) {
+		return m_surfaces[surface_nr].texels.data() + (y * m_surface_size + x) * get_bytes_per_texel();
+	}
+	const uint8_t* texel_ptr(int surface_nr, int x, int y) const {
+		return m_surfaces[surface_nr].texels.data() + (y * m_surface_size + x) * get_bytes_per_texel();
+	}
 	void add_surface();
+	AtlasRegion allocate(int w, int h, bool allow_rotation, int first_surface);
+	void insert_region(const AtlasRegion& r);
+	void fill_region(const AtlasRegion& r);
+	// merge the last free rect into the others, which were merged before
+	void merge_free_rects(Surface& s);
+	void mark_dirty(int surface_nr, const Rect& r);
+	void find_position(int surface_nr, int w, int h, bool allow_rotation,
+	                   AtlasRegion& best, int& best_short, int& best_long) const;
+	void split_free_rects(Surface& s, const Rect& used);
+	bool load_surface(const char* name, std::vector<uint8_t>& texels) const;
 };
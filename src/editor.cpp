@@ -11,18 +11,154 @@
 
 
 
+void Editor::init() {
+	m_renderer.init();
+}
+
+
 void Editor::snap_to_grid() {
-	for (WallRef& ref : m_selection) {
-		Wall& wall = map.sectors[ref.sector_nr].walls[ref.wall_nr];
-		wall.pos.x = std::floor(wall.pos.x + 0.5);
-		wall.pos.y = std::floor(wall.pos.y + 0.5);
+	m_history.begin();
+	move_selection(glm::vec2(0), true);
+	m_history.end();
+}
+
+
+void Editor::sort_selection() {
+	std::sort(m_selection.begin(), m_selection.end());
+	m_selection.erase(std::unique(m_selection.begin(), m_selection.end()), m_selection.end());
+}
+
+
+void Editor::select_box(const glm::vec2& r1, const glm::vec2& r2, bool keep_old) {
+	if (!keep_old) m_selection.clear();
+	// add the nearest wall or all walls in selection rect
+	update_wall_grid();
+	if (r1 == r2) {
+		WallRef ref = m_wall_grid.nearest_vertex(map.sectors, r1, m_zoom * 7);
+		if (ref.sector_nr != -1) m_selection.push_back(ref);
 	}
+	else m_wall_grid.find_vertices(map.sectors, r1, r2, m_selection);
+	if (keep_old) sort_selection();
+}
+
+
+void Editor::drag_selection(const glm::vec2& mov) {
+	m_history.begin();
+	move_selection(mov, false);
+	snap_to_grid();
+	m_history.end();
+}
+
+
+void Editor::delete_selection() {
+	m_history.begin();
+	record_selection();
+	// NOTE: inverse direction is important
+	for (int i = m_selection.size() - 1;  i >= 0; --i) {
+		WallRef& ref = m_selection[i];
+		Sector& s = map.sectors[ref.sector_nr];
+		s.walls.erase(s.walls.begin() + ref.wall_nr);
+	}
+	m_selection.clear();
+	for (int i = 0; i < (int) map.sectors.size();) {
+		if (map.sectors[i].walls.size() > 2) {
+			++i;
+			continue;
+		}
+		m_history.record_erase(map.sectors, i);
+		map.sectors.erase(map.sectors.begin() + i);
+	}
+	m_history.end();
 	map.setup_portals();
 }
 
 
+void Editor::change_heights(float floor, float ceil) {
+	m_history.begin();
+	record_selection();
+	m_history.end();
+	int nr = -1;
+	for (const WallRef& ref : m_selection) {
+		if (ref.sector_nr == nr) continue;
+		nr = ref.sector_nr;
+		map.sectors[nr].floor_height += floor;
+		map.sectors[nr].ceil_height += ceil;
+	}
+	// heights decide which walls are portals
+	relink_selection();
+}
+
+
+void Editor::update_wall_grid() {
+	if (m_wall_grid_revision == map.revision) return;
+	m_wall_grid.build(map.sectors);
+	m_wall_grid_revision = map.revision;
+}
+
+
+void Editor::record_selection() {
+	for (const WallRef& ref : m_selection) m_history.record_modify(map.sectors, ref.sector_nr);
+}
+
+
+void Editor::relink_selection() {
+	std::vector<int> sector_nrs;
+	for (const WallRef& ref : m_selection) sector_nrs.push_back(ref.sector_nr);
+	map.relink_sectors(sector_nrs);
+}
+
+
+void Editor::undo(bool redo) {
+	std::vector<int> modified;
+	if (redo ? !m_history.redo(map.sectors, modified) : !m_history.undo(map.sectors, modified)) return;
+	m_selection.clear();
+	if (modified.empty()) map.setup_portals();
+	else map.relink_sectors(modified);
+}
+
+
+void Editor::move_selection(const glm::vec2& mov, bool snap) {
+	// drawing calls this on every mouse motion while the button is held
+	if (m_selection.empty() || (mov == glm::vec2(0) && !snap)) return;
+	// a drag can outlive its step, eg. when the editor is switched on with the button held
+	m_history.begin();
+	update_wall_grid();
+	record_selection();
+	std::vector<WallRef> segments;
+	int wall_count = 0;
+	for (const WallRef& ref : m_selection) {
+		int n = map.sectors[ref.sector_nr].walls.size();
+		segments.push_back(ref);
+		segments.push_back({ ref.sector_nr, (ref.wall_nr + n - 1) % n });
+		wall_count += n;
+	}
+	std::sort(segments.begin(), segments.end());
+	segments.erase(std::unique(segments.begin(), segments.end()), segments.end());
+
+	for (const WallRef& ref : m_selection) m_wall_grid.remove_vertex(map.sectors, ref);
+	for (const WallRef& ref : segments) m_wall_grid.remove_segment(map.sectors, ref);
+	for (const WallRef& ref : m_selection) {
+		Wall& wall = map.sectors[ref.sector_nr].walls[ref.wall_nr];
+		wall.pos += mov;
+		if (snap) {
+			wall.pos.x = std::floor(wall.pos.x + 0.5);
+			wall.pos.y = std::floor(wall.pos.y + 0.5);
+		}
+	}
+	for (const WallRef& ref : m_selection) m_wall_grid.insert_vertex(map.sectors, ref);
+	for (const WallRef& ref : segments) m_wall_grid.insert_segment(map.sectors, ref);
+
+	relink_selection();
+	// relinking drops walls whose vertices ended up on top of each other
+	for (const WallRef& ref : m_selection) wall_count -= map.sectors[ref.sector_nr].walls.size();
+	if (wall_count == 0) m_wall_grid_revision = map.revision;
+	m_history.end();
+}
+
+
 void Editor::split_sector() {
 	if (m_selection.size() < 2) return;
+	m_history.begin();
 	// find line refs
 	int n1, n2;
 	int i;
@@ -43,22 +179,30 @@ void Editor::split_sector() {
 		if (a2 < 0) a2 += 2 * M_PI;
 		if (a1 < a2) break;
 	}
-	if (i == (int) m_selection.size() - 1) return;
+	if (i == (int) m_selection.size() - 1) {
+		m_history.end();
+		return;
+	}
+	int sector_nr = m_selection[i].sector_nr;
 	m_selection.clear();
 
 	Sector new_sector;
-	Sector& s = map.sectors[m_selection[i].sector_nr];
+	m_history.record_modify(map.sectors, sector_nr);
+	Sector& s = map.sectors[sector_nr];
 	new_sector.floor_height = s.floor_height;
 	new_sector.ceil_height = s.ceil_height;
 	new_sector.walls = std::vector<Wall>(s.walls.begin() + n1, s.walls.begin() + n2 + 1);
 	s.walls.erase(s.walls.begin() + n1 + 1, s.walls.begin() + n2);
 
 	map.sectors.emplace_back(std::move(new_sector));
+	m_history.record_insert(map.sectors.size() - 1);
+	m_history.end();
 	map.setup_portals();
 }
 
 
 void Editor::merge_sectors() {
+	m_history.begin();
 	for (int i = 0; i < (int) m_selection.size() - 1; ++i) {
 		if (m_selection[i].sector_nr != m_selection[i].sector_nr) continue;
 		Sector& s = map.sectors[m_selection[i].sector_nr];
@@ -68,6 +212,8 @@ void Editor::merge_sectors() {
 		if (n1 == 0) n1 = n2;
 		Wall w = s.walls[n1];
 		if (w.refs.size() != 1 || w.refs[0].sector_nr == m_selection[i].sector_nr) continue;
+		m_history.record_modify(map.sectors, m_selection[i].sector_nr);
+		m_history.record_erase(map.sectors, w.refs[0].sector_nr);
 		Sector& s2 = map.sectors[w.refs[0].sector_nr];
 		for (int j = (w.refs[0].wall_nr + 2) % s2.walls.size();
 			j != w.refs[0].wall_nr;
@@ -79,6 +225,7 @@ void Editor::merge_sectors() {
 		m_selection.clear();
 		break;
 	}
+	m_history.end();
 }
 
 
@@ -99,6 +246,13 @@ void Editor::keyboard(const SDL_KeyboardEvent& key) {
 		return;
 	}
 
+	// undo, redo
+	if (ctrl && (key.keysym.sym == SDLK_z || key.keysym.sym == SDLK_y)) {
+		bool shift = ks[SDL_SCANCODE_LSHIFT] || ks[SDL_SCANCODE_RSHIFT];
+		undo(key.keysym.sym == SDLK_y || shift);
+		return;
+	}
+
 	// snap to grid
 	if (key.keysym.sym == SDLK_v) {
 		snap_to_grid();
@@ -107,18 +261,7 @@ void Editor::keyboard(const SDL_KeyboardEvent& key) {
 
 	// delete
 	if (key.keysym.sym == SDLK_x) {
-		// NOTE: inverse direction is important
-		for (int i = m_selection.size() - 1;  i >= 0; --i) {
-			WallRef& ref = m_selection[i];
-			Sector& s = map.sectors[ref.sector_nr];
-			s.walls.erase(s.walls.begin() + ref.wall_nr);
-		}
-		m_selection.clear();
-		for (auto it = map.sectors.begin(); it != map.sectors.end();) {
-			if (it->walls.size() <= 2) it = map.sectors.erase(it);
-			else ++it;
-		}
-		map.setup_portals();
+		delete_selection();
 		return;
 	}
 
@@ -139,6 +282,7 @@ void Editor::keyboard(const SDL_KeyboardEvent& key) {
 		if (ctrl) map.save("media/map.txt");
 		else {
 			m_selection.clear();
+			m_history.clear();
 			map.load("media/map.txt");
 		}
 		return;
@@ -148,21 +292,11 @@ void Editor::keyboard(const SDL_KeyboardEvent& key) {
 	int i = (key.keysym.sym == SDLK_COMMA) - (key.keysym.sym == SDLK_PERIOD);
 	if (i != 0) {
 		if (ks[SDL_SCANCODE_F]) {
-			int nr = -1;
-			for (const WallRef& ref : m_selection) {
-				if (ref.sector_nr == nr) continue;
-				nr = ref.sector_nr;
-				map.sectors[nr].floor_height += i;
-			}
+			change_heights(i, 0);
 			return;
 		}
 		if (ks[SDL_SCANCODE_C]) {
-			int nr = -1;
-			for (const WallRef& ref : m_selection) {
-				if (ref.sector_nr == nr) continue;
-				nr = ref.sector_nr;
-				map.sectors[nr].ceil_height += i;
-			}
+			change_heights(0, i);
 			return;
 		}
 	}
@@ -178,27 +312,20 @@ void Editor::mouse_button(const SDL_MouseButtonEvent& button) {
 
 	if (button.button == SDL_BUTTON_LEFT) {
 		if (button.type == SDL_MOUSEBUTTONDOWN) {
+			// everything up to releasing the button is undone in one step
+			m_history.begin();
 
 			// add vertex
 			if (ks[SDL_SCANCODE_C]) {
-				float dist = 10;
-				WallRef ref { -1 };
-				for (int i = 0; i < (int) map.sectors.size(); ++i) {
-					Sector& sector = map.sectors[i];
-					for (int j = 0; j < (int) sector.walls.size(); ++j) {
-						Wall& w1 = sector.walls[j];
-						Wall& w2 = sector.walls[(j + 1) % sector.walls.size()];
-						float d = point_to_line_segment_distance(m_cursor, w1.pos, w2.pos);
-						if (d < dist) {
-							dist = d;
-							ref.sector_nr = i;
-							ref.wall_nr = j;
-						}
-					}
-				}
+				update_wall_grid();
+				WallRef ref = m_wall_grid.nearest_segment(map.sectors, m_cursor, 10);
 				if (ref.sector_nr != -1) {
 					m_selection.clear();
 
+					m_history.record_modify(map.sectors, ref.sector_nr);
+					for (const WallRef& r : map.sectors[ref.sector_nr].walls[ref.wall_nr].refs) {
+						m_history.record_modify(map.sectors, r.sector_nr);
+					}
 					Sector& sector = map.sectors[ref.sector_nr];
 					sector.walls.insert(sector.walls.begin() + ref.wall_nr + 1, { m_cursor });
 					m_selection.push_back({ ref.sector_nr, ref.wall_nr + 1 });
@@ -211,7 +338,7 @@ void Editor::mouse_button(const SDL_MouseButtonEvent& button) {
 							m_selection.push_back({ ref.sector_nr, ref.wall_nr + 1 });
 						}
 					}
-					map.setup_portals();
+					relink_selection();
 				}
 				return;
 			}
@@ -227,6 +354,7 @@ void Editor::mouse_button(const SDL_MouseButtonEvent& button) {
 					},
 					0, 10
 				});
+				m_history.record_insert(map.sectors.size() - 1);
 				map.setup_portals();
 				m_selection.clear();
 				for (int i = 0; i < 4; ++i) {
@@ -237,12 +365,14 @@ void Editor::mouse_button(const SDL_MouseButtonEvent& button) {
 
 			// set player position
 			if (ks[SDL_SCANCODE_P]) {
-				eye.loc.pos.x = m_cursor.x;
-				eye.loc.pos.z = m_cursor.y;
-				eye.loc.sector_nr = map.pick_sector(m_cursor);
-				if (eye.loc.sector_nr != -1) {
-					eye.loc.pos.y = map.sectors[eye.loc.sector_nr].floor_height + 4;
+				Location loc = eye.loc;
+				loc.pos.x = m_cursor.x;
+				loc.pos.z = m_cursor.y;
+				loc.sector_nr = map.pick_sector(m_cursor);
+				if (loc.sector_nr != -1) {
+					loc.pos.y = map.sectors[loc.sector_nr].floor_height + 4;
 				}
+				eye.set_location(loc);
 			}
 
 		}
@@ -250,6 +380,7 @@ void Editor::mouse_button(const SDL_MouseButtonEvent& button) {
 		// auto snapping
 		if (button.type == SDL_MOUSEBUTTONUP) {
 			snap_to_grid();
+			m_history.end();
 		}
 	}
 
@@ -264,54 +395,19 @@ void Editor::mouse_button(const SDL_MouseButtonEvent& button) {
 
 			// add to selection
 			bool keep_old = ks[SDL_SCANCODE_LCTRL] || ks[SDL_SCANCODE_RCTRL];
-			if (!keep_old) m_selection.clear();
-			glm::vec2 b1 = m_select_pos;
-			glm::vec2 b2 = m_cursor;
-			bool just_one = b1 == b2;
-
-			if (just_one && button.clicks == 2) {
-				// add all walls of picked sector
-				int nr = map.pick_sector(m_cursor);
-				if (nr == -1) return;
-				for (int i = 0; i < (int) map.sectors[nr].walls.size(); ++i) {
-					m_selection.push_back({ nr, i });
-				}
-			}
-			else {
-				// add walls in selection rect
-				if (just_one) {
-					b1 -= glm::vec2(m_zoom * 7);
-					b2 += glm::vec2(m_zoom * 7);
-				}
-				for (int i = 0; i < (int) map.sectors.size(); ++i) {
-					Sector& sector = map.sectors[i];
-					for (int j = 0; j < (int) sector.walls.size(); ++j) {
-						Wall& wall = sector.walls[j];
-						if (point_in_rect(wall.pos, b1, b2)) {
-							m_selection.push_back({ i, j });
-							if (just_one) {
-								i = map.sectors.size();
-								break;
-							}
-						}
-					}
-				}
+			if (m_select_pos != m_cursor || button.clicks != 2) {
+				select_box(m_select_pos, m_cursor, keep_old);
+				return;
 			}
 
-
-			if (keep_old) {
-				// keep selection sorted
-				std::sort(m_selection.begin(), m_selection.end());
-				// remove duplicate
-				for (int i = 0; i < (int) m_selection.size() - 1;) {
-					if (m_selection[i] == m_selection[i + 1]) {
-						m_selection.erase(m_selection.begin() + i + 1);
-					}
-					else ++i;
-				}
+			// add all walls of picked sector
+			if (!keep_old) m_selection.clear();
+			int nr = map.pick_sector(m_cursor);
+			if (nr == -1) return;
+			for (int i = 0; i < (int) map.sectors[nr].walls.size(); ++i) {
+				m_selection.push_back({ nr, i });
 			}
-
-
+			if (keep_old) sort_selection();
 		}
 	}
 }
@@ -321,21 +417,11 @@ void Editor::mouse_wheel(const SDL_MouseWheelEvent& wheel) {
 	if (!m_edit_enabled) return;
 	const uint8_t* ks = SDL_GetKeyboardState(nullptr);
 	if (ks[SDL_SCANCODE_F]) {
-		int nr = -1;
-		for (const WallRef& ref : m_selection) {
-			if (ref.sector_nr == nr) continue;
-			nr = ref.sector_nr;
-			map.sectors[nr].floor_height += wheel.y;
-		}
+		change_heights(wheel.y, 0);
 		return;
 	}
 	if (ks[SDL_SCANCODE_C]) {
-		int nr = -1;
-		for (const WallRef& ref : m_selection) {
-			if (ref.sector_nr == nr) continue;
-			nr = ref.sector_nr;
-			map.sectors[nr].ceil_height += wheel.y;
-		}
+		change_heights(0, wheel.y);
 		return;
 	}
 
@@ -365,13 +451,7 @@ void Editor::draw() {
 		}
 
 		// move selection
-		if (buttons & SDL_BUTTON_LMASK) {
-			for (WallRef& ref : m_selection) {
-				Wall& wall = map.sectors[ref.sector_nr].walls[ref.wall_nr];
-				wall.pos += mov;
-			}
-			map.setup_portals();
-		}
+		if (buttons & SDL_BUTTON_LMASK) move_selection(mov, false);
 	}
 
 
@@ -386,20 +466,7 @@ void Editor::draw() {
 
 
 	// grid
-	renderer2D.set_line_width(1);
-	if (m_grid_enabled) {
-		renderer2D.set_color(100, 100, 100);
-		int inc = 1;
-		int w = rmw::context.get_width() / 2;
-		int h = rmw::context.get_height() / 2;
-		float x1 = std::floor((-m_scroll.x - m_zoom * w) / inc) * inc;
-		float x2 = std::floor((-m_scroll.x + m_zoom * w) / inc + 1) * inc;
-		float y1 = std::floor((-m_scroll.y - m_zoom * h) / inc) * inc;
-		float y2 = std::floor((-m_scroll.y + m_zoom * h) / inc + 1) * inc;
-
-		for (int x = x1; x < x2; x += inc) renderer2D.line(x, y1, x, y2);
-		for (int y = y1; y < y2; y += inc) renderer2D.line(x1, y, x2, y);
-	}
+	if (m_grid_enabled) m_renderer.draw_grid(m_zoom, m_scroll);
 	renderer2D.set_line_width(3);
 
 
@@ -431,40 +498,23 @@ void Editor::draw() {
 
 	// map
 	renderer2D.set_point_size(7);
-	for (int i = 0; i < (int) map.sectors.size(); ++i) {
-		Sector& sector = map.sectors[i];
-
-
-		if (eye.loc.sector_nr == i) {
-			renderer2D.set_color(100, 255, 255, 50);
-			std::vector<glm::vec2> poly;
-			for (const Wall& w : sector.walls) poly.emplace_back(w.pos);
-			triangulate(poly, [](
-				const glm::vec2& p1,
-				const glm::vec2& p2,
-				const glm::vec2& p3)
-			{
-				renderer2D.triangle(p1, p2, p3);
-			});
-		}
-
-
-		for (int j = 0; j < (int) sector.walls.size(); ++j) {
-			Wall& w1 = sector.walls[j];
-			Wall& w2 = sector.walls[(j + 1) % sector.walls.size()];
-			if (w1.refs.empty()) renderer2D.set_color(200, 200, 200);
-			else renderer2D.set_color(200, 0, 0);
-			renderer2D.line(w1.pos, w2.pos);
-		}
-	}
-	renderer2D.set_color(200, 200, 200);
-	for (int i = 0; i < (int) map.sectors.size(); ++i) {
-		Sector& sector = map.sectors[i];
-		for (int j = 0; j < (int) sector.walls.size(); ++j) {
-			renderer2D.point(sector.walls[j].pos);
+	if (eye.loc.sector_nr >= 0 && eye.loc.sector_nr < (int) map.sectors.size()) {
+		// reuse the floor triangles instead of triangulating every frame
+		renderer2D.set_color(100, 255, 255, 50);
+		for (const MapFace& f : map.get_faces(map.sectors[eye.loc.sector_nr])) {
+			if (f.tex_nr != 1) continue;
+			Span<const MapVertex> vs = map.get_verts(f);
+			for (int j = 0; j + 2 < vs.size(); j += 3) {
+				renderer2D.triangle(vs[j].uv, vs[j + 1].uv, vs[j + 2].uv);
+			}
 		}
 	}
 
+	// walls and vertices come from the cached wireframe
+	renderer2D.flush();
+	m_renderer.update(map);
+	m_renderer.draw_map(m_zoom, m_scroll, 3, 7);
+
 
 	// player
 	renderer2D.set_line_width(1);
@@ -1,22 +1,45 @@
 #pragma once
 
 #include "map.h"
+#include "wall_grid.h"
+#include "editor_renderer.h"
+#include "undo_history.h"
 
 #include <SDL2/SDL.h>
 
 
 class Editor {
 public:
+	void init();
 	void draw();
 	void mouse_button(const SDL_MouseButtonEvent& button);
 	void mouse_wheel(const SDL_MouseWheelEvent& wheel);
 	void keyboard(const SDL_KeyboardEvent& key);
 
-private:
-
-	void snap_to_grid();
+	// edit operations, each one undo step.
+	// the input handlers map onto these, bench/editor_macro drives them directly.
+	void select_box(const glm::vec2& r1, const glm::vec2& r2, bool keep_old);
+	// move the selection and snap it to the grid like a drag with the mouse
+	void drag_selection(const glm::vec2& mov);
+	void delete_selection();
 	void split_sector();
 	void merge_sectors();
+	void change_heights(float floor, float ceil);
+	void snap_to_grid();
+	void undo(bool redo);
+	void clear_selection() { m_selection.clear(); }
+
+private:
+
+	// rebuild the wall grid if the map changed behind its back
+	void update_wall_grid();
+	// move the selected vertices and update the wall grid along with them
+	void move_selection(const glm::vec2& mov, bool snap);
+	// record the sectors of the selection for undo
+	void record_selection();
+	// relink the sectors of the selection after their walls or heights changed
+	void relink_selection();
+	void sort_selection();
 
 
 	glm::vec2				m_scroll;
@@ -31,6 +54,13 @@ private:
 	bool					m_grid_enabled = false;
 
 	bool					m_edit_enabled = false;
+
+	WallGrid				m_wall_grid;
+	int						m_wall_grid_revision = -1;
+
+	EditorRenderer			m_renderer;
+
+	UndoHistory				m_history;
 };
 
 
@@ -0,0 +1,383 @@
+#include "editor_renderer.h"
+
+#include <algorithm>
+#include <limits>
+
+
+// quadtree leaves hold at most this many sectors
+#ifndef LOD_LEAF_SECTORS
+#define LOD_LEAF_SECTORS 32
+#endif
+#ifndef LOD_MAX_DEPTH
+#define LOD_MAX_DEPTH 20
+#endif
+// outlines snap to a grid with this many cells across the node
+#ifndef LOD_OUTLINE_CELLS
+#define LOD_OUTLINE_CELLS 8
+#endif
+// nodes smaller than this on screen are drawn as their outline
+#ifndef LOD_NODE_PIXELS
+#define LOD_NODE_PIXELS 64.0f
+#endif
+// vertex points are only drawn where walls are on average at least this long on screen
+#ifndef LOD_POINT_PIXELS
+#define LOD_POINT_PIXELS 12.0f
+#endif
+
+
+void EditorRenderer::init() {
+    m_map_shader = rmw::context.create_shader(
+        R"(#version 100
+            attribute vec2 in_pos;
+            attribute vec4 in_color;
+            uniform vec2 resolution;
+            uniform vec2 scale;
+            uniform vec2 offset;
+            uniform float point_size;
+            uniform vec4 solid_color;
+            varying vec4 ex_color;
+            void main() {
+                vec2 p = (in_pos * scale + offset) / resolution * 2.0 - vec2(1.0, 1.0);
+                gl_Position = vec4(p.x, -p.y, 0.0, 1.0);
+                ex_color = mix(in_color, solid_color, solid_color.a);
+                gl_PointSize = point_size;
+            })",
+        R"(#version 100
+            precision mediump float;
+            varying vec4 ex_color;
+            void main() {
+                gl_FragColor = vec4(ex_color.rgb, 1.0);
+            })");
+
+    // one pixel wide lines at integer map coordinates
+    m_grid_shader = rmw::context.create_shader(
+        R"(#version 100
+            attribute vec2 in_pos;
+            void main() {
+                gl_Position = vec4(in_pos, 0.0, 1.0);
+            })",
+        R"(#version 100
+            #ifdef GL_FRAGMENT_PRECISION_HIGH
+            precision highp float;
+            #else
+            precision mediump float;
+            #endif
+            uniform vec2 resolution;
+            uniform float zoom;
+            uniform vec2 scroll;
+            void main() {
+                vec2 screen = vec2(gl_FragCoord.x, resolution.y - gl_FragCoord.y) - resolution * 0.5;
+                vec2 p = screen * zoom - scroll;
+                vec2 d = abs(fract(p + 0.5) - 0.5) / zoom;
+                if (min(d.x, d.y) >= 0.5) discard;
+                gl_FragColor = vec4(vec3(100.0 / 255.0), 1.0);
+            })");
+
+    m_rs.depth_test_enabled = false;
+
+    m_vb = rmw::context.create_vertex_buffer(rmw::BufferHint::DynamicDraw);
+    m_line_va = rmw::context.create_vertex_array();
+    m_line_va->set_primitive_type(rmw::PrimitiveType::Lines);
+    m_line_va->set_attribute(0, m_vb, rmw::ComponentType::Float, 2, false, 0, sizeof(Vert));
+    m_line_va->set_attribute(1, m_vb, rmw::ComponentType::Uint8, 4, true,  8, sizeof(Vert));
+    m_point_va = rmw::context.create_vertex_array();
+    m_point_va->set_primitive_type(rmw::PrimitiveType::Points);
+    m_point_va->set_attribute(0, m_vb, rmw::ComponentType::Float, 2, false, 0, sizeof(Vert) * 2);
+    m_point_va->set_attribute(1, m_vb, rmw::ComponentType::Uint8, 4, true,  8, sizeof(Vert) * 2);
+
+    m_outline_vb = rmw::context.create_vertex_buffer(rmw::BufferHint::DynamicDraw);
+    m_outline_va = rmw::context.create_vertex_array();
+    m_outline_va->set_primitive_type(rmw::PrimitiveType::Lines);
+    m_outline_va->set_attribute(0, m_outline_vb, rmw::ComponentType::Float, 2, false, 0, sizeof(glm::vec2));
+
+    std::vector<glm::vec2> quad = { { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 } };
+    m_quad_vb = rmw::context.create_vertex_buffer(rmw::BufferHint::StaticDraw);
+    m_quad_vb->init_data(quad);
+    m_quad_va = rmw::context.create_vertex_array();
+    m_quad_va->set_primitive_type(rmw::PrimitiveType::TriangleStrip);
+    m_quad_va->set_attribute(0, m_quad_vb, rmw::ComponentType::Float, 2, false, 0, sizeof(glm::vec2));
+    m_quad_va->set_count(quad.size());
+}
+
+
+void EditorRenderer::emit_walls(const Sector& s, std::vector<Vert>& verts) {
+    for (int j = 0; j < (int) s.walls.size(); ++j) {
+        const Wall& w1 = s.walls[j];
+        const Wall& w2 = s.walls[(j + 1) % s.walls.size()];
+        glm::u8vec4 color = w1.refs.empty() ? glm::u8vec4(200, 200, 200, 255) : glm::u8vec4(200, 0, 0, 255);
+        verts.push_back({ w1.pos, color });
+        verts.push_back({ w2.pos, color });
+    }
+}
+
+
+int EditorRenderer::build_node(const Map& map, int parent, std::vector<int> sector_nrs,
+                               const std::vector<glm::vec2>& centers, glm::vec2 min, float size, int depth) {
+    int node_nr = m_nodes.size();
+    m_nodes.emplace_back();
+    Node& node = m_nodes.back();
+    node.size               = size;
+    node.parent             = parent;
+    node.leaf               = (int) sector_nrs.size() <= LOD_LEAF_SECTORS || depth == LOD_MAX_DEPTH;
+    node.dirty              = true;
+    node.first_wall         = m_verts.size() / 2;
+    node.first_outline_vert = 0;
+    node.outline_count      = 0;
+    node.outline_capacity   = 0;
+    std::fill(node.children, node.children + 4, -1);
+
+    if (node.leaf) {
+        for (int i : sector_nrs) {
+            const Sector& s = map.sectors[i];
+            m_ranges[i] = { (int) m_verts.size() / 2, (int) s.walls.size(), s.face_key, node_nr };
+            emit_walls(s, m_verts);
+        }
+    }
+    else {
+        std::vector<int> quadrants[4];
+        glm::vec2 mid = min + size * 0.5f;
+        for (int i : sector_nrs) {
+            quadrants[(centers[i].x >= mid.x) + (centers[i].y >= mid.y) * 2].push_back(i);
+        }
+        sector_nrs = {};
+        for (int q = 0; q < 4; ++q) {
+            if (quadrants[q].empty()) continue;
+            glm::vec2 m = min + glm::vec2(q & 1, q >> 1) * size * 0.5f;
+            // m_nodes may grow, so don't hold on to node
+            int c = build_node(map, node_nr, std::move(quadrants[q]), centers, m, size * 0.5f, depth + 1);
+            m_nodes[node_nr].children[q] = c;
+        }
+    }
+    m_nodes[node_nr].wall_count = m_verts.size() / 2 - m_nodes[node_nr].first_wall;
+    return node_nr;
+}
+
+
+// vertex clustering: snap line ends to the node's grid and drop what collapses or repeats.
+// shared walls of neighbouring sectors are drawn once.
+void EditorRenderer::update_node(Node& node, std::vector<glm::vec2>& outline) const {
+    float cell = node.size / LOD_OUTLINE_CELLS;
+    std::vector<glm::ivec4> lines;
+    auto add = [&](const glm::vec2& a, const glm::vec2& b) {
+        glm::ivec2 qa = glm::ivec2(glm::round(a / cell));
+        glm::ivec2 qb = glm::ivec2(glm::round(b / cell));
+        if (qa == qb) return;
+        if (qb.x < qa.x || (qb.x == qa.x && qb.y < qa.y)) std::swap(qa, qb);
+        lines.emplace_back(qa.x, qa.y, qb.x, qb.y);
+    };
+
+    node.min = glm::vec2(std::numeric_limits<float>::max());
+    node.max = glm::vec2(-std::numeric_limits<float>::max());
+    if (node.leaf) {
+        float length = 0;
+        for (int i = node.first_wall * 2; i < (node.first_wall + node.wall_count) * 2; i += 2) {
+            const glm::vec2& a = m_verts[i].pos;
+            const glm::vec2& b = m_verts[i + 1].pos;
+            node.min = glm::min(node.min, a);
+            node.max = glm::max(node.max, a);
+            length += glm::distance(a, b);
+            add(a, b);
+        }
+        node.wall_length = node.wall_count > 0 ? length / node.wall_count : 0;
+    }
+    else {
+        for (int c : node.children) {
+            if (c == -1) continue;
+            const Node& child = m_nodes[c];
+            node.min = glm::min(node.min, child.min);
+            node.max = glm::max(node.max, child.max);
+            auto it = m_outline_overflow.find(c);
+            const glm::vec2* v = it != m_outline_overflow.end() ? it->second.data()
+                                                                : m_outline_verts.data() + child.first_outline_vert;
+            for (int i = 0; i < child.outline_count; i += 2) add(v[i], v[i + 1]);
+        }
+    }
+
+    std::sort(lines.begin(), lines.end(), [](const glm::ivec4& a, const glm::ivec4& b) {
+        return std::lexicographical_compare(&a[0], &a[0] + 4, &b[0], &b[0] + 4);
+    });
+    lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+    outline.clear();
+    for (const glm::ivec4& l : lines) {
+        outline.push_back(glm::vec2(l.x, l.y) * cell);
+        outline.push_back(glm::vec2(l.z, l.w) * cell);
+    }
+    node.dirty = false;
+}
+
+
+void EditorRenderer::update_dirty_nodes() {
+    // children come after their parents
+    std::vector<glm::vec2> outline;
+    for (int i = m_nodes.size() - 1; i >= 0; --i) {
+        Node& node = m_nodes[i];
+        if (!node.dirty) continue;
+        update_node(node, outline);
+        node.outline_count = outline.size();
+        if (node.outline_count > node.outline_capacity) {
+            m_outline_overflow[i] = outline;
+            continue;
+        }
+        glm::vec2* v = m_outline_verts.data() + node.first_outline_vert;
+        std::copy(outline.begin(), outline.end(), v);
+        std::fill(v + node.outline_count, v + node.outline_capacity, outline.empty() ? node.min : outline.back());
+        m_outline_vb->update_data(node.first_outline_vert * sizeof(glm::vec2), v,
+                                  node.outline_capacity * sizeof(glm::vec2));
+    }
+    if (m_outline_overflow.empty()) return;
+
+    // lay everything out again, breadth first,
+    // so that the nodes cut off at similar depths end up next to each other
+    std::vector<glm::vec2> verts;
+    std::vector<int> queue = { 0 };
+    for (int i = 0; i < (int) queue.size(); ++i) {
+        Node& node = m_nodes[queue[i]];
+        auto it = m_outline_overflow.find(queue[i]);
+        const glm::vec2* v = it != m_outline_overflow.end() ? it->second.data()
+                                                            : m_outline_verts.data() + node.first_outline_vert;
+        node.first_outline_vert = verts.size();
+        node.outline_capacity   = node.outline_count + (node.outline_count / 16 + 2) * 2;
+        glm::vec2 pad = node.outline_count > 0 ? v[node.outline_count - 1] : node.min;
+        verts.insert(verts.end(), v, v + node.outline_count);
+        verts.resize(node.first_outline_vert + node.outline_capacity, pad);
+        for (int c : node.children) {
+            if (c != -1) queue.push_back(c);
+        }
+    }
+    m_outline_verts.swap(verts);
+    m_outline_overflow.clear();
+    m_outline_vb->init_data(m_outline_verts);
+}
+
+
+void EditorRenderer::update(const Map& map) {
+    if (map.revision == m_revision) return;
+    m_revision = map.revision;
+
+    // the face key covers wall positions and portals, which is all the wireframe shows
+    bool rebuild = map.sectors.size() != m_ranges.size();
+    for (int i = 0; i < (int) map.sectors.size() && !rebuild; ++i) {
+        rebuild = (int) map.sectors[i].walls.size() != m_ranges[i].wall_count;
+    }
+
+    if (rebuild) {
+        std::vector<glm::vec2> centers(map.sectors.size());
+        std::vector<int> sector_nrs;
+        glm::vec2 min(std::numeric_limits<float>::max());
+        glm::vec2 max(-std::numeric_limits<float>::max());
+        for (int i = 0; i < (int) map.sectors.size(); ++i) {
+            const Sector& s = map.sectors[i];
+            if (s.walls.empty()) continue;
+            glm::vec2 a = s.walls[0].pos;
+            glm::vec2 b = a;
+            for (const Wall& w : s.walls) {
+                a = glm::min(a, w.pos);
+                b = glm::max(b, w.pos);
+            }
+            centers[i] = (a + b) * 0.5f;
+            min = glm::min(min, centers[i]);
+            max = glm::max(max, centers[i]);
+            sector_nrs.push_back(i);
+        }
+
+        m_ranges.assign(map.sectors.size(), { 0, 0, 0, -1 });
+        m_verts.clear();
+        m_nodes.clear();
+        m_outline_verts.clear();
+        if (!sector_nrs.empty()) {
+            float size = std::max(std::max(max.x - min.x, max.y - min.y), 1.0f);
+            build_node(map, -1, std::move(sector_nrs), centers, min, size, 0);
+        }
+        m_vb->init_data(m_verts);
+        update_dirty_nodes();
+        return;
+    }
+
+    std::vector<Vert> verts;
+    for (int i = 0; i < (int) map.sectors.size(); ++i) {
+        const Sector& s = map.sectors[i];
+        SectorRange& r = m_ranges[i];
+        if (s.face_key == r.face_key) continue;
+        r.face_key = s.face_key;
+        verts.clear();
+        emit_walls(s, verts);
+        std::copy(verts.begin(), verts.end(), m_verts.begin() + r.first_wall * 2);
+        m_vb->update_data(r.first_wall * 2 * sizeof(Vert), verts.data(), verts.size() * sizeof(Vert));
+        for (int n = r.node_nr; n != -1 && !m_nodes[n].dirty; n = m_nodes[n].parent) m_nodes[n].dirty = true;
+    }
+    update_dirty_nodes();
+}
+
+
+static void add_range(std::vector<glm::ivec2>& ranges, int first, int count) {
+    if (!ranges.empty() && ranges.back().x + ranges.back().y == first) ranges.back().y += count;
+    else ranges.emplace_back(first, count);
+}
+
+
+void EditorRenderer::collect(int node_nr, float zoom, const glm::vec2& view_min, const glm::vec2& view_max) {
+    const Node& node = m_nodes[node_nr];
+    if (node.max.x < view_min.x || node.max.y < view_min.y ||
+        node.min.x > view_max.x || node.min.y > view_max.y) return;
+
+    glm::vec2 extent = node.max - node.min;
+    if (std::max(extent.x, extent.y) / zoom < LOD_NODE_PIXELS) {
+        add_range(m_outline_ranges, node.first_outline_vert, node.outline_capacity);
+        return;
+    }
+    if (node.leaf) {
+        add_range(m_line_ranges, node.first_wall, node.wall_count);
+        if (node.wall_length / zoom >= LOD_POINT_PIXELS) add_range(m_point_ranges, node.first_wall, node.wall_count);
+        return;
+    }
+    for (int c : node.children) {
+        if (c != -1) collect(c, zoom, view_min, view_max);
+    }
+}
+
+
+void EditorRenderer::draw_grid(float zoom, const glm::vec2& scroll) {
+    m_grid_shader->set_uniform("resolution", glm::vec2(rmw::context.get_width(), rmw::context.get_height()));
+    m_grid_shader->set_uniform("zoom", zoom);
+    m_grid_shader->set_uniform("scroll", scroll);
+    rmw::context.draw(m_rs, m_grid_shader, m_quad_va);
+}
+
+
+void EditorRenderer::draw_map(float zoom, const glm::vec2& scroll, float line_width, float point_size) {
+    glm::vec2 resolution(rmw::context.get_width(), rmw::context.get_height());
+    m_map_shader->set_uniform("resolution", resolution);
+    m_map_shader->set_uniform("scale", glm::vec2(1 / zoom));
+    m_map_shader->set_uniform("offset", resolution * 0.5f + scroll / zoom);
+    m_map_shader->set_uniform("point_size", point_size);
+
+    m_line_ranges.clear();
+    m_point_ranges.clear();
+    m_outline_ranges.clear();
+    if (!m_nodes.empty()) {
+        // lines and points reach a few pixels past the walls
+        glm::vec2 margin = glm::vec2(std::max(line_width, point_size)) * zoom;
+        glm::vec2 half = resolution * 0.5f * zoom + margin;
+        collect(0, zoom, -scroll - half, -scroll + half);
+    }
+
+    m_rs.line_width = line_width;
+    m_map_shader->set_uniform("solid_color", glm::vec4(0));
+    for (const glm::ivec2& r : m_line_ranges) {
+        m_line_va->set_first(r.x * 2);
+        m_line_va->set_count(r.y * 2);
+        rmw::context.draw(m_rs, m_map_shader, m_line_va);
+    }
+
+    m_map_shader->set_uniform("solid_color", glm::vec4(glm::vec3(200 / 255.0f), 1));
+    for (const glm::ivec2& r : m_outline_ranges) {
+        m_outline_va->set_first(r.x);
+        m_outline_va->set_count(r.y);
+        rmw::context.draw(m_rs, m_map_shader, m_outline_va);
+    }
+    for (const glm::ivec2& r : m_point_ranges) {
+        m_point_va->set_first(r.x);
+        m_point_va->set_count(r.y);
+        rmw::context.draw(m_rs, m_map_shader, m_point_va);
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "rmw.h"
+#include "map.h"
+
+#include <unordered_map>
+
+
+// the static parts of the editor's 2D view: the map wireframe lives in a vertex buffer
+// that is only patched for sectors whose walls changed, and the grid is drawn by a shader.
+// pan and zoom are uniforms, so neither is rebuilt on the CPU per frame.
+//
+// for big maps the sectors are sorted into a quadtree. nodes outside the view are culled,
+// nodes that are small on screen are drawn as a simplified outline of everything below them,
+// and vertex points are left out where walls are only a few pixels long.
+class EditorRenderer {
+public:
+    void init();
+
+    // re-upload the walls of sectors that changed since the last call,
+    // everything if sectors or walls were added or removed
+    void update(const Map& map);
+
+    // same view transform as the editor's: screen = center + (p + scroll) / zoom
+    void draw_grid(float zoom, const glm::vec2& scroll);
+    void draw_map(float zoom, const glm::vec2& scroll, float line_width, float point_size);
+
+private:
+    struct Vert {
+        glm::vec2   pos;
+        glm::u8vec4 color;
+    };
+
+    // two vertices per wall, the first of each pair doubles as the wall's point
+    struct SectorRange {
+        int    first_wall;
+        int    wall_count;
+        size_t face_key;
+        int    node_nr;
+    };
+
+    // nodes are stored depth first and walls are emitted in leaf order,
+    // so the walls below any node form one contiguous range
+    struct Node {
+        glm::vec2              min;
+        glm::vec2              max;
+        float                  size;            // edge length of the node's square
+        int                    parent;
+        int                    children[4];
+        bool                   leaf;
+        bool                   dirty;           // bounds and outline need an update
+        int                    first_wall;
+        int                    wall_count;
+        float                  wall_length;     // average, decides whether points are drawn
+        // line pairs in m_outline_verts, padded with empty lines up to the capacity
+        // so that small changes can be written in place
+        int                    first_outline_vert;
+        int                    outline_count;
+        int                    outline_capacity;
+    };
+
+    static void emit_walls(const Sector& s, std::vector<Vert>& verts);
+    int         build_node(const Map& map, int parent, std::vector<int> sector_nrs,
+                           const std::vector<glm::vec2>& centers, glm::vec2 min, float size, int depth);
+    void        update_node(Node& node, std::vector<glm::vec2>& outline) const;
+    void        update_dirty_nodes();
+    void        collect(int node_nr, float zoom, const glm::vec2& view_min, const glm::vec2& view_max);
+
+    std::vector<SectorRange> m_ranges;
+    int                      m_revision = -1;
+    std::vector<Vert>        m_verts;
+    std::vector<Node>        m_nodes;
+    std::vector<glm::vec2>   m_outline_verts;
+    // new outlines that outgrew their place, until everything is laid out again
+    std::unordered_map<int, std::vector<glm::vec2>> m_outline_overflow;
+    // what is drawn this frame, wall and outline vertex ranges, merged where they touch
+    std::vector<glm::ivec2>  m_line_ranges;
+    std::vector<glm::ivec2>  m_point_ranges;
+    std::vector<glm::ivec2>  m_outline_ranges;
+
+    rmw::RenderState         m_rs;
+    rmw::Shader::Ptr         m_map_shader;
+    rmw::Shader::Ptr         m_grid_shader;
+    rmw::VertexBuffer::Ptr   m_vb;
+    rmw::VertexArray::Ptr    m_line_va;
+    rmw::VertexArray::Ptr    m_point_va;
+    rmw::VertexBuffer::Ptr   m_outline_vb;
+    rmw::VertexArray::Ptr    m_outline_va;
+    rmw::VertexBuffer::Ptr   m_quad_vb;
+    rmw::VertexArray::Ptr    m_quad_va;
+};
@@ -2,30 +2,79 @@
 
 
 #include <algorithm>
+#include <cmath>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/transform.hpp>
 #include <SDL2/SDL.h>
 
 
+// simulation ticks per second
+#ifndef EYE_TICK_RATE
+#define EYE_TICK_RATE 60
+#endif
+// most ticks simulated per frame. after a longer stall the simulation falls behind
+// instead of spending ever longer frames catching up
+#ifndef EYE_MAX_TICKS
+#define EYE_MAX_TICKS 5
+#endif
+
+// per second
+#define EYE_MOVE_SPEED 18.0f
+#define EYE_TURN_SPEED 1.8f
+
+
 void Eye::init() {
 	loc.pos = { 0, 0, 0 };
 	loc.sector_nr = map.pick_sector(glm::vec2(loc.pos.x, loc.pos.z));
 	ang_x = 0;
 	ang_y = 0;
+	set_location(loc);
 }
 
 
-void Eye::update() {
+void Eye::set_location(const Location& l) {
+	loc = prev_loc = view_loc = l;
+	prev_ang_x = view_ang_x = ang_x;
+	prev_ang_y = view_ang_y = ang_y;
+}
 
-	auto ks = SDL_GetKeyboardState(nullptr);
 
-	ang_y += (ks[SDL_SCANCODE_RIGHT]	- ks[SDL_SCANCODE_LEFT]		) * 0.03;
-	ang_x += (ks[SDL_SCANCODE_DOWN]		- ks[SDL_SCANCODE_UP]		) * 0.03;
+void Eye::update(float dt, const Uint8* keys) {
+	const float tick_time = 1.0f / EYE_TICK_RATE;
+
+	accumulator += dt;
+	int ticks = 0;
+	while (accumulator >= tick_time && ticks < EYE_MAX_TICKS) {
+		prev_loc   = loc;
+		prev_ang_x = ang_x;
+		prev_ang_y = ang_y;
+		tick(tick_time, keys);
+		accumulator -= tick_time;
+		++ticks;
+	}
+	accumulator = fmodf(accumulator, tick_time);
+
+	float alpha = accumulator / tick_time;
+	view_ang_x = glm::mix(prev_ang_x, ang_x, alpha);
+	view_ang_y = glm::mix(prev_ang_y, ang_y, alpha);
+	// the blended position may still be in the sector the tick left
+	view_loc = loc;
+	view_loc.pos = glm::mix(prev_loc.pos, loc.pos, alpha);
+	if (!map.fix_sector(view_loc)) view_loc = loc;
+}
+
+
+void Eye::tick(float dt, const Uint8* ks) {
+
+	float turn = EYE_TURN_SPEED * dt;
+	ang_y += (ks[SDL_SCANCODE_RIGHT]	- ks[SDL_SCANCODE_LEFT]		) * turn;
+	ang_x += (ks[SDL_SCANCODE_DOWN]		- ks[SDL_SCANCODE_UP]		) * turn;
 	ang_x = std::max<float>(-M_PI * 0.5, std::min<float>(M_PI * 0.5, ang_x));
 
-	float x = (ks[SDL_SCANCODE_D]		- ks[SDL_SCANCODE_A]		) * 0.3;
-	float z = (ks[SDL_SCANCODE_S]		- ks[SDL_SCANCODE_W]		) * 0.3;
-	float y = (ks[SDL_SCANCODE_SPACE]	- ks[SDL_SCANCODE_LSHIFT]	) * 0.3;
+	float speed = EYE_MOVE_SPEED * dt;
+	float x = (ks[SDL_SCANCODE_D]		- ks[SDL_SCANCODE_A]		) * speed;
+	float z = (ks[SDL_SCANCODE_S]		- ks[SDL_SCANCODE_W]		) * speed;
+	float y = (ks[SDL_SCANCODE_SPACE]	- ks[SDL_SCANCODE_LSHIFT]	) * speed;
 
 	float cy = cosf(ang_y);
 	float sy = sinf(ang_y);
@@ -44,8 +93,7 @@ void Eye::update() {
 
 
 glm::mat4x4 Eye::get_view_mtx() const {
-	return	glm::rotate<float>(ang_x, glm::vec3(1, 0, 0)) *
-			glm::rotate<float>(ang_y, glm::vec3(0, 1, 0)) *
-			glm::translate(-loc.pos);
+	return	glm::rotate<float>(view_ang_x, glm::vec3(1, 0, 0)) *
+			glm::rotate<float>(view_ang_y, glm::vec3(0, 1, 0)) *
+			glm::translate(-view_loc.pos);
 }
-
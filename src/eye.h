@@ -6,18 +6,40 @@
 #include "editor.h"
 
 
+// the simulation runs in fixed ticks, independent of the frame rate.
+// rendering sees the state blended between the last two ticks.
 class Eye {
 	friend class Editor;
 public:
 	void                init();
-	void				update();
+	// advance by the seconds the last frame took, keys is indexed by scancode
+	void				update(float dt, const Uint8* keys);
+	// interpolated, for drawing
 	glm::mat4x4			get_view_mtx() const;
+	const Location&		get_view_location() const { return view_loc; }
+	// as of the last tick
 	const Location&		get_location() const { return loc; }
 	float				get_ang_y() const { return ang_y; }
+	// jump there without blending over from the old position
+	void				set_location(const Location& l);
 private:
+	void				tick(float dt, const Uint8* keys);
+
 	Location	loc;
 	float		ang_x;
 	float		ang_y;
+
+	// state before the last tick
+	Location	prev_loc;
+	float		prev_ang_x;
+	float		prev_ang_y;
+
+	// time not simulated yet, less than one tick
+	float		accumulator = 0;
+
+	Location	view_loc;
+	float		view_ang_x;
+	float		view_ang_y;
 };
 
 
@@ -0,0 +1,144 @@
+#include "jobs.h"
+
+#include <cstdio>
+
+
+// index of the calling thread's queue
+static thread_local int t_queue = 0;
+
+
+JobSystem jobs;
+
+
+JobSystem::JobSystem() {
+    m_queues.emplace_back(new Queue);
+}
+
+
+JobSystem::~JobSystem() {
+    shutdown();
+}
+
+
+void JobSystem::init(int threads) {
+    shutdown();
+#ifdef __EMSCRIPTEN__
+    threads = 0;
+#endif
+    if (threads < 0) threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    for (int i = 0; i < threads; ++i) m_queues.emplace_back(new Queue);
+    m_running = true;
+    for (int i = 1; i <= threads; ++i) m_workers.emplace_back(&JobSystem::work, this, i);
+    printf("job system: %d threads\n", get_thread_count());
+}
+
+
+void JobSystem::shutdown() {
+    m_running = false;
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    }
+    m_wake.notify_all();
+    for (std::thread& t : m_workers) t.join();
+    m_workers.clear();
+    // whatever is left runs here
+    while (run_one()) {}
+    m_queues.resize(1);
+}
+
+
+void JobSystem::run(std::function<void()> f, Counter* counter) {
+    if (counter) ++counter->m_count;
+    start({ std::move(f), counter });
+}
+
+
+void JobSystem::run_after(Counter& dependency, std::function<void()> f, Counter* counter) {
+    if (counter) ++counter->m_count;
+    {
+        std::lock_guard<std::mutex> lock(dependency.m_mutex);
+        if (dependency.m_count > 0) {
+            dependency.m_waiting.push_back({ std::move(f), counter });
+            return;
+        }
+    }
+    start({ std::move(f), counter });
+}
+
+
+void JobSystem::wait(Counter& counter) {
+    while (!counter.done()) {
+        if (!run_one()) std::this_thread::yield();
+    }
+    // the last job may still be releasing the counter
+    std::lock_guard<std::mutex> lock(counter.m_mutex);
+}
+
+
+void JobSystem::start(Job&& job) {
+    if (m_workers.empty()) {
+        job.f();
+        finish(job.counter);
+        return;
+    }
+    Queue& q = *m_queues[t_queue];
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.jobs.push_back(std::move(job));
+    }
+    ++m_queued;
+    {
+        // a worker can't miss the wake up between checking m_queued and going to sleep
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    }
+    m_wake.notify_one();
+}
+
+
+void JobSystem::finish(Counter* counter) {
+    if (!counter) return;
+    std::vector<Job> released;
+    {
+        std::lock_guard<std::mutex> lock(counter->m_mutex);
+        if (--counter->m_count > 0) return;
+        released.swap(counter->m_waiting);
+    }
+    for (Job& job : released) start(std::move(job));
+}
+
+
+bool JobSystem::run_one() {
+    Job job;
+    bool found = false;
+    int n = m_queues.size();
+    for (int i = 0; i < n && !found; ++i) {
+        Queue& q = *m_queues[(t_queue + i) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.jobs.empty()) continue;
+        // newest of our own jobs, oldest of someone else's
+        if (i == 0) {
+            job = std::move(q.jobs.back());
+            q.jobs.pop_back();
+        }
+        else {
+            job = std::move(q.jobs.front());
+            q.jobs.pop_front();
+        }
+        found = true;
+    }
+    if (!found) return false;
+    --m_queued;
+    job.f();
+    finish(job.counter);
+    return true;
+}
+
+
+void JobSystem::work(int nr) {
+    t_queue = nr;
+    while (m_running) {
+        if (run_one()) continue;
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_wake.wait(lock, [this]() { return m_queued > 0 || !m_running; });
+    }
+}
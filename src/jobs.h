@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// engine wide pool of worker threads.
+// every thread has its own deque: it pushes and pops its jobs at the back,
+// idle threads steal from the front of the others. waiting on a counter runs jobs meanwhile,
+// so jobs may wait for jobs they spawned. without init(), and in the browser build,
+// jobs run on the thread that waits for them.
+class JobSystem {
+public:
+    // the number of unfinished jobs that were started with it.
+    // jobs can be held back until another counter reaches zero.
+    class Counter {
+        friend class JobSystem;
+    public:
+        bool done() const { return m_count == 0; }
+    private:
+        struct Job {
+            std::function<void()> f;
+            Counter*              counter;
+        };
+        std::atomic<int>  m_count { 0 };
+        std::mutex        m_mutex;
+        std::vector<Job>  m_waiting;
+    };
+
+    JobSystem();
+    ~JobSystem();
+
+    // threads counts the workers besides the calling thread, -1 picks one per core
+    void init(int threads=-1);
+    void shutdown();
+    int  get_thread_count() const { return m_workers.size() + 1; }
+
+    // counter may be null for jobs nobody waits for
+    void run(std::function<void()> f, Counter* counter);
+    // f starts once dependency is done
+    void run_after(Counter& dependency, std::function<void()> f, Counter* counter);
+    // run jobs until counter is done
+    void wait(Counter& counter);
+
+    // f(first, last) on consecutive pieces of [begin, end) with at most grain elements, returns when all are done
+    template <class Func>
+    void parallel_for(int begin, int end, int grain, Func f) {
+        Counter counter;
+        for (int first = begin; first < end; first += grain) {
+            int last = std::min(first + grain, end);
+            run([&f, first, last]() { f(first, last); }, &counter);
+        }
+        wait(counter);
+    }
+
+private:
+    typedef Counter::Job Job;
+
+    struct Queue {
+        std::mutex      mutex;
+        std::deque<Job> jobs;
+    };
+
+    // queue the job, or run it right away if there are no workers
+    void start(Job&& job);
+    void finish(Counter* counter);
+    bool run_one();
+    void work(int nr);
+
+    // queue 0 is shared by all threads that aren't workers
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread>            m_workers;
+    std::atomic<int>                    m_queued { 0 };
+    std::atomic<bool>                   m_running { false };
+    std::mutex                          m_sleep_mutex;
+    std::condition_variable             m_wake;
+};
+
+
+extern JobSystem jobs;
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+
+// the subset of KTX 2.0 used for cooked textures:
+// uncompressed R8G8B8A8 2D textures, no supercompression, level data tightly packed
+namespace ktx2 {
+
+const uint8_t IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+enum {
+    VK_FORMAT_R8G8B8A8_UNORM = 37,
+    VK_FORMAT_R8G8B8A8_SRGB  = 43,
+};
+
+struct Header {
+    uint8_t  identifier[12];
+    uint32_t vk_format;
+    uint32_t type_size;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t layer_count;
+    uint32_t face_count;
+    uint32_t level_count;
+    uint32_t supercompression_scheme;
+    uint32_t dfd_byte_offset;
+    uint32_t dfd_byte_length;
+    uint32_t kvd_byte_offset;
+    uint32_t kvd_byte_length;
+    uint64_t sgd_byte_offset;
+    uint64_t sgd_byte_length;
+};
+static_assert(sizeof(Header) == 80, "unexpected ktx2 header layout");
+
+// follows the header, one per level, level 0 first
+struct LevelIndex {
+    uint64_t byte_offset;
+    uint64_t byte_length;
+    uint64_t uncompressed_byte_length;
+};
+
+} // namespace ktx2
@@ -15,158 +15,37 @@
 #include "map.h"
 #include "eye.h"
 #include "editor.h"
+#include "map_renderer.h"
+#include "world_streamer.h"
+#include "jobs.h"
+#include "simulation.h"
 
 
-Renderer2D renderer2D;
-Renderer3D renderer3D;
-
-Eye    eye;
-Editor editor;
-
-
-class MapRenderer {
-public:
-
-    void init() {
-
-        shader = rmw::context.create_shader(
-            R"(#version 100
-                attribute vec3 in_pos;
-                attribute vec2 in_uv;
-                attribute vec2 in_uv2;
-                uniform mat4 mvp;
-                varying vec2 ex_uv;
-                varying vec2 ex_uv2;
-                varying float ex_depth;
-                void main() {
-                    gl_Position = mvp * vec4(in_pos, 1.0);
-                    ex_uv = in_uv;
-                    ex_uv2 = in_uv2;
-                    ex_depth = gl_Position.z;
-                })",
-            R"(#version 100
-                precision mediump float;
-                varying vec2 ex_uv;
-                varying vec2 ex_uv2;
-                varying float ex_depth;
-                uniform sampler2D tex;
-                uniform sampler2D shadow;
-                void main() {
-                    vec4 c = texture2D(tex, ex_uv) * texture2D(shadow, ex_uv2);
-                    gl_FragColor = vec4(c.rgb * pow(0.99, ex_depth), c.a);
-                })");
-
-        vertex_buffer = rmw::context.create_vertex_buffer(rmw::BufferHint::StreamDraw);
-        vertex_array = rmw::context.create_vertex_array();
-        vertex_array->set_primitive_type(rmw::PrimitiveType::Triangles);
-        vertex_array->set_attribute(0, vertex_buffer, rmw::ComponentType::Float, 3, false, 0, sizeof(MapVertex));
-        vertex_array->set_attribute(1, vertex_buffer, rmw::ComponentType::Float, 2, false, 12, sizeof(MapVertex));
-        vertex_array->set_attribute(2, vertex_buffer, rmw::ComponentType::Float, 2, false, 20, sizeof(MapVertex));
-
-        textures[0] = rmw::context.create_texture_2D("media/wall.png");
-        textures[1] = rmw::context.create_texture_2D("media/floor.png");
-        textures[2] = rmw::context.create_texture_2D("media/ceil.png");
-        shadow_map = rmw::context.create_texture_2D(map.shadow_atlas.m_surfaces[0], rmw::FilterMode::Linear);
-    }
-
-
-    void draw(const rmw::RenderState& rs, const rmw::Framebuffer::Ptr& fb) {
-
-        for (Mesh& m : meshes) m.clear();
-
-        for (int i = 0; i < (int) map.sectors.size(); ++i) {
-            const Sector& s = map.sectors[i];
-
-            for (const MapFace& f : s.faces) {
-                Mesh& m = meshes[f.tex_nr];
-                m.insert(m.end(), f.verts.begin(), f.verts.end());
-            }
-        }
-
-
-        glm::mat4 mat_perspective = glm::perspective(
-            glm::radians(60.0f),
-            rmw::context.get_aspect_ratio(),
-            0.1f, 500.0f);
-
-        glm::mat4 mat_view = eye.get_view_mtx();
-        shader->set_uniform("mvp", mat_perspective * mat_view);
-        shader->set_uniform("shadow", shadow_map);
-
-
-        for (int i = 0; i < (int) meshes.size(); ++i) {
-            vertex_buffer->init_data(meshes[i]);
-            vertex_array->set_count(meshes[i].size());
-            shader->set_uniform("tex", textures[i]);
-            rmw::context.draw(rs, shader, vertex_array, fb);
-        }
-
-
-//        if (0)
-//        {
-//            renderer3D.set_transformation(mat_perspective * mat_view);
-//            renderer3D.set_line_width(3);
-//            renderer3D.set_point_size(5);
-//
-//            static glm::vec3 orig;
-//            static glm::vec3 dir;
-//            static glm::vec3 mark;
-//            static glm::vec3 mark_normal;
-//
-//            int x, y;
-//            int b = SDL_GetMouseState(&x, &y);
-//            if (b) {
-//                orig = eye.get_location().pos;
-//                glm::vec4 c = glm::vec4(x / (float) rmw::context.get_width() * 2 - 1,
-//                                        y / (float) rmw::context.get_height() * -2 + 1, -1, 1);
-//                glm::vec4 v = glm::inverse(mat_perspective * mat_view) * c;
-//                dir = glm::normalize(glm::vec3(v) / v.w - orig);
-//
-//                WallRef ref;
-//                float f = map.ray_intersect(eye.get_location(), dir, ref, mark_normal);
-//                mark = eye.get_location().pos + dir * f;
-//
-//                if (ref.wall_nr == -2) {
-//                    auto& fs = map.sectors[ref.sector_nr].faces;
-//                    auto& f = fs[fs.size() - 2];
-//                    auto t = glm::ivec2(glm::floor(glm::vec2(f.inv_mat * glm::vec4(mark, 1)) + glm::vec2(0.5)));
-//                    auto s = map.shadow_atlas.m_surfaces[0];
-//                    auto p = (glm::u8vec3 *) ((uint8_t * ) s->pixels + (t.y + f.shadow.y) * s->pitch + (t.x + f.shadow.x) * sizeof(glm::u8vec3));
-//                    p->r = 255;
-//                    p->g = 0;
-//                    p->b = 0;
-//                    shadow_map = rmw::context.create_texture_2D(s);
-//                }
-//            }
-//
-//            renderer3D.set_color(0, 255, 0);
-//            renderer3D.point(mark);
-//            renderer3D.set_color(0, 100, 0);
-//            renderer3D.line(mark, mark + mark_normal * 3.0f);
-//            renderer3D.flush();
-//        }
-    }
-
-
-
-private:
-    typedef std::vector<MapVertex> Mesh;
+// page the chunks of a chunked media/map.pmap in and out around the eye instead of loading it whole
+#ifndef STREAM_WORLD
+#define STREAM_WORLD 0
+#endif
 
+// simulate the next frame on a thread of its own while the current one is drawn
+#ifndef SIM_THREAD
+#define SIM_THREAD 0
+#endif
 
-    rmw::Shader::Ptr                   shader;
-    rmw::VertexBuffer::Ptr             vertex_buffer;
-    rmw::VertexArray::Ptr              vertex_array;
 
-    std::array<Mesh, 3>                meshes;
-    std::array<rmw::Texture2D::Ptr, 3> textures;
-    rmw::Texture2D::Ptr                shadow_map;
+Renderer2D renderer2D;
+Renderer3D renderer3D;
 
-} renderer;
+Eye         eye;
+Editor      editor;
+MapRenderer renderer;
+WorldStreamer streamer;
 
 
 bool running = true;
 
 void loop(void* args) {
+    // the editor changes the map and the eye, which the simulation thread reads
+    std::unique_lock<std::mutex> lock(simulation.get_mutex());
     SDL_Event e;
     while (rmw::context.poll_event(e)) {
         switch (e.type) {
@@ -175,6 +54,7 @@ void loop(void* args) {
             break;
         case SDL_KEYDOWN:
             if (e.key.keysym.scancode == SDL_SCANCODE_ESCAPE) running = false;
+            renderer.keyboard(e.key);
             editor.keyboard(e.key);
             break;
         case SDL_KEYUP:
@@ -202,14 +82,18 @@ void loop(void* args) {
     }
 
 
+    lock.unlock();
+
+
     // update
-    eye.update();
+    const Frame& frame = simulation.next_frame();
+    streamer.update(frame.loc);
 
     // render
     rmw::context.clear(rmw::ClearState { { 0, 0, 1, 1 } });
     rmw::RenderState rs;
     rs.depth_test_enabled = true;
-    renderer.draw(rs, rmw::context.get_default_framebuffer());
+    renderer.draw(rs, rmw::context.get_default_framebuffer(), frame);
 
 //    rmw::context.clear(rmw::ClearState { { 0, 0, 1, 1 } }, fb);
 //    renderer.draw(rs, fb);
@@ -217,20 +101,27 @@ void loop(void* args) {
 //    shader->set_uniform("tex", offscreen_color);
 //    rmw::context.draw(rs, shader, va);
 
+    lock.lock();
     editor.draw();
+    lock.unlock();
     rmw::context.flip_buffers();
 }
 
 
 int main(int argc, char** argv) {
     rmw::context.init(800, 600, "portal");
+    jobs.init();
+
+    if (!STREAM_WORLD || !streamer.open("media/map.pmap")) map.init("media/map");
 
     renderer2D.init();
     renderer3D.init();
 
     renderer.init();
+    editor.init();
 
     eye.init();
+    simulation.init(SIM_THREAD);
 
 //    auto vb = rmw::context.create_vertex_buffer(rmw::BufferHint::StreamDraw);
 //    std::vector<int8_t> data = { 0, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, };
@@ -266,5 +157,6 @@ int main(int argc, char** argv) {
     emscripten_set_main_loop_arg(loop, nullptr, -1, true);
 #else
     while (running) loop(nullptr);
+    simulation.shutdown();
 #endif
 }
@@ -1,15 +1,30 @@
 #include "map.h"
 #include "eye.h"
 #include "math.h"
+#include "pmap.h"
+#include "map_text.h"
+#include "jobs.h"
 
 
 #include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
 #include <algorithm>
+#include <atomic>
 #include <limits>
+#include <map>
+#include <mutex>
 #include <queue>
+#include <random>
 #include <unordered_map>
+#include <unordered_set>
 #include <glm/gtx/hash.hpp>
 #include <glm/gtx/norm.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 namespace std {
@@ -23,20 +38,85 @@ namespace std {
 }
 
 
+// set to 16 for high quality bakes without banding
+#ifndef SHADOW_BITS
+#define SHADOW_BITS 8
+#endif
+
+#if SHADOW_BITS == 16
+#define SHADOW_FORMAT   Atlas::Format::R16
+#define SHADOW_CACHE    "sm%d.raw"
+#else
+#define SHADOW_FORMAT   Atlas::Format::R8
+#define SHADOW_CACHE    "sm%d.png"
+#endif
+
+// edge length of the shadow atlas surfaces
+#ifndef SHADOW_ATLAS_SIZE
+#define SHADOW_ATLAS_SIZE 512
+#endif
+
+// sectors per face building job, smaller rebuilds stay on the calling thread
+#ifndef FACE_JOB_SECTORS
+#define FACE_JOB_SECTORS 256
+#endif
+// faces per uv assignment job
+#ifndef FACE_JOB_FACES
+#define FACE_JOB_FACES 4096
+#endif
+
+// edge length of the cells relink_sectors looks up neighbours in
+#ifndef SECTOR_GRID_CELL_SIZE
+#define SECTOR_GRID_CELL_SIZE 32.0f
+#endif
+
+
 Map::Map() {
-    load("media/map.txt");
-//    shadow_atlas.init();
-//    for (Sector& s : sectors) setup_sector_faces(s);
-    bool loaded = shadow_atlas.load_surface("sm.png");
+    shadow_atlas.set_format(SHADOW_FORMAT);
+    shadow_atlas.set_surface_size(SHADOW_ATLAS_SIZE);
+}
+
+
+void Map::init(const char* name) {
+    std::string pmap_name = std::string(name) + ".pmap";
+    std::string txt_name  = std::string(name) + ".txt";
+
+    auto start = std::chrono::steady_clock::now();
+    struct stat pmap_stat, txt_stat;
+    bool fresh = stat(pmap_name.c_str(), &pmap_stat) == 0
+              && (stat(txt_name.c_str(), &txt_stat) != 0 || pmap_stat.st_mtime >= txt_stat.st_mtime);
+    if (!fresh || !load_pmap(pmap_name.c_str())) load(txt_name.c_str());
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    printf("map loaded in %.1f ms\n", ms.count());
+    init_shadows();
+}
+
+
+void Map::init_shadows() {
+    bool loaded = shadow_atlas.load_surfaces(SHADOW_CACHE);
     if (!loaded) {
         bake();
-        shadow_atlas.save();
+        shadow_atlas.save(SHADOW_CACHE);
     }
 }
 
 
-static float rand_float() { return rand() / (float) RAND_MAX; }
+static void print_atlas_stats(const Atlas& atlas) {
+    Atlas::Stats stats = atlas.get_stats();
+    printf("shadow atlas: %d surfaces, %.1f%% occupied, %lld texels wasted\n",
+           stats.surface_count, stats.occupancy, stats.wasted_texels);
+}
+
 
+MapFace pmap_face(const pmap::Face& p) {
+    MapFace f;
+    f.normal     = glm::vec3(p.normal[0], p.normal[1], p.normal[2]);
+    f.tex_nr     = p.tex_nr;
+    f.shadow     = { p.surface_nr, p.x, p.y, p.w, p.h, p.rotated != 0 };
+    f.first_vert = p.first_vert;
+    f.vert_count = p.vert_count;
+    return f;
+}
 
 
 bool Map::fix_sector(Location& loc) const {
@@ -56,22 +136,15 @@ bool Map::fix_sector(Location& loc) const {
             continue;
         }
 
-        bool success = false;
-        for (int j = 0; j < (int) s.walls.size(); ++j) {
-            const glm::vec2& w1 = s.walls[j].pos;
-            const glm::vec2& w2 = s.walls[(j + 1) % s.walls.size()].pos;
-            glm::vec2 ww = w2 - w1;
-            glm::vec2 pw = p - w1;
-            if ((w1.y <= p.y) == (w2.y > p.y) && (pw.x < ww.x * pw.y / ww.y)) {
-                success = !success;
+        if (point_in_rect(p, s.min, s.max)) {
+            int cell_nr = locate_cell(s, p, nr == loc.sector_nr ? loc.cell_nr : 0);
+            if (cell_nr >= 0) {
+                loc.sector_nr = nr;
+                loc.cell_nr = cell_nr;
+                return true;
             }
         }
 
-        if (success) {
-            loc.sector_nr = nr;
-            return true;
-        }
-
         for (int j = 0; j < (int) s.walls.size(); ++j) {
             const Wall& w = s.walls[j];
             glm::vec2 ww = s.walls[(j + 1) % s.walls.size()].pos - w.pos;
@@ -90,83 +163,99 @@ bool Map::fix_sector(Location& loc) const {
 void Map::bake() {
     printf("baking shadow maps (this may take a minute)...\n");
 
-    SDL_Surface* surf = shadow_atlas.m_surfaces[0];
+    face_transforms.resize(faces.size());
+    for (int i = 0; i < (int) faces.size(); ++i) face_transforms[i] = face_transform(faces[i]);
 
+    // sectors are baked in parallel, each with its own random numbers so the result
+    // doesn't depend on the thread count. the atlas keeps track of dirty texels, so
+    // writing into it is serialized.
+    std::mutex atlas_mutex;
+    std::atomic<int> baked { 0 };
+    jobs.parallel_for(0, sectors.size(), 1, [&](int first, int last) {
+        for (int i = first; i < last; ++i) {
 
-    for (int i = 0; i < (int) sectors.size(); ++i) {
+            const Sector& s = sectors[i];
 
-        printf("baking sector %d\n", i);
+            Location loc;
+            std::minstd_rand rng(i + 1);
+            std::uniform_real_distribution<float> rand_float(-1, 1);
 
-        const Sector& s = sectors[i];
+            for (int face_nr = s.first_face; face_nr < s.first_face + s.face_count; ++face_nr) {
+                const MapFace& f = faces[face_nr];
+                const glm::mat4& mat = face_transforms[face_nr].mat;
 
-        Location loc;
+                // negative values mark texels outside of the map
+                std::vector<float> shade(f.shadow.w * f.shadow.h);
+                auto pix = [&shade, w = f.shadow.w](int x, int y) -> float& {
+                    return shade[y * w + x];
+                };
 
-        for (const MapFace& f : s.faces) {
+                for (int y = 0; y < f.shadow.h; ++y)
+                for (int x = 0; x < f.shadow.w; ++x) {
 
-            auto pix = [
-                data = (uint8_t *) surf->pixels,
-                 xx = f.shadow.x,
-                 yy = f.shadow.y,
-                 pitch = surf->pitch
-            ](int x, int y) -> glm::u8vec3& {
-                return *(glm::u8vec3 *) (data + (y + yy) * pitch + (x + xx) * sizeof(glm::u8vec3));
-            };
+                    float& pixel = pix(x, y);
 
-            for (int y = 0; y < f.shadow.h; ++y)
-            for (int x = 0; x < f.shadow.w; ++x) {
+                    loc.sector_nr = i;
+                    loc.pos = glm::vec3(mat * glm::vec4(x + 0.01, y + 0.01, 0, 1)) + f.normal * 0.01f;
+                    if (!fix_sector(loc)) {
+                        pixel = -1;
+                        continue;
+                    }
 
-                glm::u8vec3& pixel = pix(x, y);
 
-                loc.sector_nr = i;
-                loc.pos = glm::vec3(f.mat * glm::vec4(x + 0.01, y + 0.01, 0, 1)) + f.normal * 0.01f;
-                if (!fix_sector(loc)) {
-                    pixel = { 255, 0, 0 };
-                    continue;
-                }
+                    float a = 0;
+                    int N = 10000;
+                    for (int k = 0; k < N; ++k) {
+                        glm::vec3 normal;
+                        WallRef ref;
+                        glm::vec3 dir;
+                        for (int j = 0; j < 5; ++j) {
+                            dir.x = rand_float(rng);
+                            dir.y = rand_float(rng);
+                            dir.z = rand_float(rng);
+                            if (glm::length2(dir) <= 1) break;
+                        }
 
+                        if (glm::dot(dir, f.normal) < 0) dir = -dir;
 
-                float a = 0;
-                int N = 10000;
-                for (int k = 0; k < N; ++k) {
-                    glm::vec3 normal;
-                    WallRef ref;
-                    glm::vec3 dir;
-                    for (int j = 0; j < 5; ++j) {
-                        dir.x = 2 * rand_float() - 1;
-                        dir.y = 2 * rand_float() - 1;
-                        dir.z = 2 * rand_float() - 1;
-                        if (glm::length2(dir) <= 1) break;
+                        float f = ray_intersect(loc, dir, ref, normal, 60);
+                        a += f / 60 / N;
                     }
 
-                    if (glm::dot(dir, f.normal) < 0) dir = -dir;
+                    pixel = powf(a, 1.3);
 
-                    float f = ray_intersect(loc, dir, ref, normal, 60);
-                    a += f / 60 / N;
                 }
 
-                pixel.r = pixel.g = pixel.b = 255 * powf(a, 1.3);
-
-            }
 
+                for (int y = 0; y < f.shadow.h; ++y)
+                for (int x = 0; x < f.shadow.w; ++x) {
+                    float& p = pix(x, y);
+                    if (p < 0) {
+                        p = 1;
 
-            for (int y = 0; y < f.shadow.h; ++y)
-            for (int x = 0; x < f.shadow.w; ++x) {
-                glm::u8vec3& p = pix(x, y);
-                if (p == glm::u8vec3(255, 0, 0)) {
-                    p = { 255, 255, 255 };
+                        if (x > 0 && pix(x - 1, y) >= 0) p = std::min(p, pix(x - 1, y));
+                        if (x < f.shadow.w - 1 && pix(x + 1, y) >= 0) p = std::min(p, pix(x + 1, y));
+                        if (y > 0 && pix(x, y - 1) >= 0) p = std::min(p, pix(x, y - 1));
+                        if (y < f.shadow.h - 1 && pix(x, y + 1) >= 0) p = std::min(p, pix(x, y + 1));
 
-                    if (x > 0 && pix(x - 1, y) != glm::u8vec3(255, 0, 0)) p = glm::min(p, pix(x - 1, y));
-                    if (x < f.shadow.w - 1 && pix(x + 1, y) != glm::u8vec3(255, 0, 0)) p = glm::min(p, pix(x + 1, y));
-                    if (y > 0 && pix(x, y - 1) != glm::u8vec3(255, 0, 0)) p = glm::min(p, pix(x, y - 1));
-                    if (y < f.shadow.h - 1 && pix(x, y + 1) != glm::u8vec3(255, 0, 0)) p = glm::min(p, pix(x, y + 1));
 
+                    }
+                }
 
+                std::lock_guard<std::mutex> lock(atlas_mutex);
+                for (int y = 0; y < f.shadow.h; ++y)
+                for (int x = 0; x < f.shadow.w; ++x) {
+                    shadow_atlas.set_texel(f.shadow, x, y, pix(x, y));
                 }
-            }
 
 
+            }
+            printf("baked sector %d (%d of %d)\n", i, ++baked, (int) sectors.size());
         }
-    }
+    });
+
+    face_transforms.clear();
+    face_transforms.shrink_to_fit();
 }
 
 
@@ -174,11 +263,16 @@ void Map::bake() {
 
 
 void Map::setup_sector_faces(Sector& s) {
+    setup_sector_faces(s, faces, verts);
+}
+
+
+void Map::setup_sector_faces(Sector& s, std::vector<MapFace>& out_faces, std::vector<MapVertex>& out_verts) {
 
     // walls
     // TODO: fix T junctions
-    s.faces.clear();
-    auto generate_wall_face = [this, &s](const glm::vec2& p1, float y1, const glm::vec2& p2, float y2) {
+    s.first_face = out_faces.size();
+    auto generate_wall_face = [&out_faces, &out_verts](const glm::vec2& p1, float y1, const glm::vec2& p2, float y2) {
         float u1, u2;
         glm::vec2 pp = glm::normalize(p2 - p1);
         if (abs(pp.x) > abs(pp.y)) {
@@ -190,10 +284,12 @@ void Map::setup_sector_faces(Sector& s) {
             u2 = p2.y;
         }
 
-        s.faces.emplace_back();
-        MapFace& face = s.faces.back();
+        out_faces.emplace_back();
+        MapFace& face = out_faces.back();
         face.tex_nr = 0;
         face.normal = glm::vec3(pp.y, 0, -pp.x);
+        face.first_vert = out_verts.size();
+        face.vert_count = 6;
 
         glm::vec3 d[4] = {
             glm::vec3(p1.x, y1, p1.y),
@@ -201,12 +297,12 @@ void Map::setup_sector_faces(Sector& s) {
             glm::vec3(p2.x, y1, p2.y),
             glm::vec3(p2.x, y2, p2.y),
         };
-        face.verts.emplace_back(d[0], glm::vec2(u1, y1));
-        face.verts.emplace_back(d[3], glm::vec2(u2, y2));
-        face.verts.emplace_back(d[1], glm::vec2(u1, y2));
-        face.verts.emplace_back(d[0], glm::vec2(u1, y1));
-        face.verts.emplace_back(d[2], glm::vec2(u2, y1));
-        face.verts.emplace_back(d[3], glm::vec2(u2, y2));
+        out_verts.emplace_back(d[0], glm::vec2(u1, y1));
+        out_verts.emplace_back(d[3], glm::vec2(u2, y2));
+        out_verts.emplace_back(d[1], glm::vec2(u1, y2));
+        out_verts.emplace_back(d[0], glm::vec2(u1, y1));
+        out_verts.emplace_back(d[2], glm::vec2(u2, y1));
+        out_verts.emplace_back(d[3], glm::vec2(u2, y2));
 
     };
     for (int j = 0; j < (int) s.walls.size(); ++j) {
@@ -216,7 +312,7 @@ void Map::setup_sector_faces(Sector& s) {
 
         float h = s.ceil_height;
         for (const WallRef& ref : w.refs) {
-            const Sector& s2 = map.sectors[ref.sector_nr];
+            const Sector& s2 = sectors[ref.sector_nr];
             if (s2.ceil_height < h) {
                 generate_wall_face(p1, h, p2, s2.ceil_height);
             }
@@ -235,136 +331,610 @@ void Map::setup_sector_faces(Sector& s) {
         poly.emplace_back(p);
     }
 
-    s.faces.resize(s.faces.size() + 2);
-    MapFace& floor_face = s.faces[s.faces.size() - 2];
-    MapFace& ceil_face = s.faces[s.faces.size() - 1];
-
-    floor_face.tex_nr = 1;
-    floor_face.normal = glm::vec3(0, 1, 0);
-
-    ceil_face.tex_nr = 2;
-    ceil_face.normal = glm::vec3(0, -1, 0);
-
-    triangulate(poly, [&s, &floor_face, &ceil_face]
+    std::vector<glm::ivec3> triangles;
+    triangulate(poly, [&poly, &triangles]
     (const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p3)
     {
-        floor_face.verts.emplace_back(glm::vec3(p1.x, s.floor_height, p1.y), p1);
-        floor_face.verts.emplace_back(glm::vec3(p2.x, s.floor_height, p2.y), p2);
-        floor_face.verts.emplace_back(glm::vec3(p3.x, s.floor_height, p3.y), p3);
-        ceil_face.verts.emplace_back(glm::vec3(p1.x, s.ceil_height, p1.y), p1);
-        ceil_face.verts.emplace_back(glm::vec3(p3.x, s.ceil_height, p3.y), p3);
-        ceil_face.verts.emplace_back(glm::vec3(p2.x, s.ceil_height, p2.y), p2);
+        triangles.emplace_back(&p1 - poly.data(), &p2 - poly.data(), &p3 - poly.data());
     });
+    setup_sector_cells(s, triangles);
+
+    auto generate_flat_face = [&out_faces, &out_verts, &poly, &triangles](int tex_nr, float y, bool flip) {
+        out_faces.emplace_back();
+        MapFace& face = out_faces.back();
+        face.tex_nr = tex_nr;
+        face.normal = glm::vec3(0, flip ? -1 : 1, 0);
+        face.first_vert = out_verts.size();
+        face.vert_count = triangles.size() * 3;
+        for (const glm::ivec3& t : triangles) {
+            for (int k : { 0, flip ? 2 : 1, flip ? 1 : 2 }) {
+                const glm::vec2& p = poly[t[k]];
+                out_verts.emplace_back(glm::vec3(p.x, y, p.y), p);
+            }
+        }
+    };
+    if (!triangles.empty()) {
+        generate_flat_face(1, s.floor_height, false);
+        generate_flat_face(2, s.ceil_height, true);
+    }
 
-
-    // set shadow texture coordinates
-    for (MapFace& f : s.faces) {
-        glm::vec3 min = f.verts.front().pos;
-        glm::vec3 max = f.verts.front().pos;
-        for (const MapVertex& v : f.verts) {
-            min = glm::min(min, v.pos);
-            max = glm::max(max, v.pos);
+    s.face_count = out_faces.size() - s.first_face;
+
+
+    // set shadow map size and vertex texel coordinates
+    for (int i = s.first_face; i < s.first_face + s.face_count; ++i) {
+        MapFace& f = out_faces[i];
+        Span<MapVertex> vs = { out_verts.data() + f.first_vert, out_verts.data() + f.first_vert + f.vert_count };
+        float detail;
+        glm::vec3 min;
+        glm::ivec3 size;
+        int axis = shadow_projection(f, vs, detail, min, size);
+        f.shadow.w = size[axis == 0 ? 1 : 0];
+        f.shadow.h = size[axis == 2 ? 1 : 2];
+
+        for (MapVertex& v : vs) {
+            glm::vec3 d = v.pos - min;
+            glm::vec2 uv = axis == 0 ? glm::vec2(d.y, d.z)
+                         : axis == 1 ? glm::vec2(d.x, d.z)
+                         :             glm::vec2(d.x, d.y);
+            // texel coordinates within the face's region, placed by pack_shadow_atlas
+            v.uv2 = glm::vec3(uv * detail, 0);
         }
-        min = glm::floor(min * SHADOW_DETAIL);
-        max = glm::ceil(max * SHADOW_DETAIL);
-        glm::ivec3 size = max - min + glm::vec3(1);
-        min /= SHADOW_DETAIL;
-        max /= SHADOW_DETAIL;
+    }
+}
 
 
-        auto nn = f.normal;
-        auto n = f.normal / SHADOW_DETAIL;
-        auto abs = glm::abs(n);
-        float o = 1 / SHADOW_DETAIL;
+int Map::shadow_projection(const MapFace& f, Span<const MapVertex> vs,
+                           float& detail, glm::vec3& min, glm::ivec3& size) const {
+    min = vs[0].pos;
+    glm::vec3 max = vs[0].pos;
+    for (const MapVertex& v : vs) {
+        min = glm::min(min, v.pos);
+        max = glm::max(max, v.pos);
+    }
 
-        auto pp = f.verts.front().pos - min;
-        auto t = glm::dot(pp, nn);
+    // faces too big for an atlas surface get a coarser shadow map
+    detail = SHADOW_DETAIL;
+    float extent = std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z));
+    int surface_size = shadow_atlas.get_surface_size();
+    if (extent * detail + 3 > surface_size) detail = (surface_size - 3) / extent;
+
+    min = glm::floor(min * detail);
+    max = glm::ceil(max * detail);
+    size = max - min + glm::vec3(1);
+    min /= detail;
+
+    glm::vec3 abs = glm::abs(f.normal);
+    if (abs.x > abs.y && abs.x > abs.z) return 0;
+    if (abs.y > abs.x && abs.y > abs.z) return 1;
+    return 2;
+}
 
-        if (abs.x > abs.y && abs.x > abs.z) {
-            f.shadow = shadow_atlas.allocate_region(size.y, size.z);
-            f.mat[0] = glm::vec4(-n.y / nn.x, o, 0, 0);
-            f.mat[1] = glm::vec4(-n.z / nn.x, 0, o, 0);
-            f.mat[2] = glm::vec4(f.normal, 0);
-            f.mat[3] = glm::vec4(min.x + t / nn.x, min.y, min.z, 1);
-        }
-        else if (abs.y > abs.x && abs.y > abs.z) {
-            f.shadow = shadow_atlas.allocate_region(size.x, size.z);
-            f.mat[0] = glm::vec4(o, -n.x / nn.y, 0, 0);
-            f.mat[1] = glm::vec4(0, -n.z / nn.y, o, 0);
-            f.mat[2] = glm::vec4(f.normal, 0);
-            f.mat[3] = glm::vec4(min.x, min.y + t / nn.y, min.z, 1);
-        }
-        else {
-            f.shadow = shadow_atlas.allocate_region(size.x, size.y);
-            f.mat[0] = glm::vec4(o, 0, -n.x / nn.z, 0);
-            f.mat[1] = glm::vec4(0, o, -n.y / nn.z, 0);
-            f.mat[2] = glm::vec4(f.normal, 0);
-            f.mat[3] = glm::vec4(min.x, min.y, min.z + t / nn.z, 1);
-        }
 
+FaceTransform Map::face_transform(const MapFace& f) const {
+    float detail;
+    glm::vec3 min;
+    glm::ivec3 size;
+    int axis = shadow_projection(f, get_verts(f), detail, min, size);
+
+    auto nn = f.normal;
+    auto n = f.normal / detail;
+    float o = 1 / detail;
 
-        f.inv_mat = glm::inverse(f.mat);
+    auto pp = get_verts(f)[0].pos - min;
+    auto t = glm::dot(pp, nn);
 
-        for (MapVertex& v : f.verts) {
+    FaceTransform ft;
+    glm::mat4& mat = ft.mat;
+    if (axis == 0) {
+        mat[0] = glm::vec4(-n.y / nn.x, o, 0, 0);
+        mat[1] = glm::vec4(-n.z / nn.x, 0, o, 0);
+        mat[2] = glm::vec4(f.normal, 0);
+        mat[3] = glm::vec4(min.x + t / nn.x, min.y, min.z, 1);
+    }
+    else if (axis == 1) {
+        mat[0] = glm::vec4(o, -n.x / nn.y, 0, 0);
+        mat[1] = glm::vec4(0, -n.z / nn.y, o, 0);
+        mat[2] = glm::vec4(f.normal, 0);
+        mat[3] = glm::vec4(min.x, min.y + t / nn.y, min.z, 1);
+    }
+    else {
+        mat[0] = glm::vec4(o, 0, -n.x / nn.z, 0);
+        mat[1] = glm::vec4(0, o, -n.y / nn.z, 0);
+        mat[2] = glm::vec4(f.normal, 0);
+        mat[3] = glm::vec4(min.x, min.y, min.z + t / nn.z, 1);
+    }
+    // region x runs along the face's local y
+    if (f.shadow.rotated) std::swap(mat[0], mat[1]);
 
-            if (abs.x > abs.y && abs.x > abs.z) {
-                v.uv2.x = v.pos.y - min.y;
-                v.uv2.y = v.pos.z - min.z;
+    ft.inv_mat = glm::inverse(mat);
+    return ft;
+}
+
+
+void Map::setup_sector_cells(Sector& s, const std::vector<glm::ivec3>& triangles) {
+    int n = s.walls.size();
+    s.cells.clear();
+    s.min = s.max = n > 0 ? s.walls[0].pos : glm::vec2(0);
+    for (Wall& w : s.walls) {
+        w.cell_nr = -1;
+        s.min = glm::min(s.min, w.pos);
+        s.max = glm::max(s.max, w.pos);
+    }
+    if (triangles.empty()) return;
+
+    // triangulate() flips sectors of the other orientation, their boundary then runs against the walls
+    float area = 0;
+    for (int i = 0; i < n; ++i) area += cross(s.walls[i].pos, s.walls[(i + 1) % n].pos);
+    bool reverse = area > 0;
+
+    // edges that show up in both directions are diagonals
+    auto edge_key = [n](int a, int b) { return (long long) a * n + b; };
+    std::unordered_map<long long, int> edge_triangle;
+    std::vector<std::vector<int>> pieces;
+    std::vector<int> owner;
+    for (int t = 0; t < (int) triangles.size(); ++t) {
+        const glm::ivec3& tri = triangles[t];
+        for (int k = 0; k < 3; ++k) edge_triangle[edge_key(tri[k], tri[(k + 1) % 3])] = t;
+        pieces.push_back({ tri.x, tri.y, tri.z });
+        owner.push_back(t);
+    }
+    auto find = [&owner](int t) {
+        while (owner[t] != t) t = owner[t] = owner[owner[t]];
+        return t;
+    };
+    auto pos = [&s](int i) -> const glm::vec2& { return s.walls[i].pos; };
+
+    // Hertel-Mehlhorn: drop every diagonal whose removal keeps both ends convex,
+    // which ends up within four times the minimal number of convex pieces
+    for (int t = 0; t < (int) triangles.size(); ++t)
+    for (int k = 0; k < 3; ++k) {
+        int u = triangles[t][k];
+        int v = triangles[t][(k + 1) % 3];
+        if (u > v) continue;
+        auto it = edge_triangle.find(edge_key(v, u));
+        if (it == edge_triangle.end()) continue;
+        int a = find(t);
+        int b = find(it->second);
+        if (a == b) continue;
+
+        // a runs u -> v, b runs v -> u. rotate them to v ... u and u ... v
+        std::vector<int>& pa = pieces[a];
+        std::vector<int>& pb = pieces[b];
+        std::rotate(pa.begin(), std::find(pa.begin(), pa.end(), v), pa.end());
+        std::rotate(pb.begin(), std::find(pb.begin(), pb.end(), u), pb.end());
+        if (!is_oriented_cw(pos(pa[pa.size() - 2]), pos(u), pos(pb[1]))
+        ||  !is_oriented_cw(pos(pb[pb.size() - 2]), pos(v), pos(pa[1]))) continue;
+        pa.insert(pa.end(), pb.begin() + 1, pb.end() - 1);
+        pb.clear();
+        owner[b] = a;
+    }
+
+    std::vector<int> cell_nrs(pieces.size(), -1);
+    for (int t = 0; t < (int) pieces.size(); ++t) {
+        if (owner[t] != t) continue;
+        cell_nrs[t] = s.cells.size();
+        s.cells.emplace_back();
+    }
+    for (int t = 0; t < (int) pieces.size(); ++t) {
+        if (owner[t] != t) continue;
+        SectorCell& cell = s.cells[cell_nrs[t]];
+        const std::vector<int>& piece = pieces[t];
+        for (int k = 0; k < (int) piece.size(); ++k) {
+            int a = piece[k];
+            int b = piece[(k + 1) % piece.size()];
+            auto it = edge_triangle.find(edge_key(b, a));
+            if (it != edge_triangle.end()) {
+                cell.edges.push_back({ a, -1, cell_nrs[find(it->second)] });
+                continue;
             }
-            else if (abs.y > abs.x && abs.y > abs.z) {
-                v.uv2.x = v.pos.x - min.x;
-                v.uv2.y = v.pos.z - min.z;
+            // walls, with the collinear points triangulate() dropped put back
+            for (int i = a; i != b; i = reverse ? (i + n - 1) % n : (i + 1) % n) {
+                int wall_nr = reverse ? (i + n - 1) % n : i;
+                cell.edges.push_back({ i, wall_nr, -1 });
+                s.walls[wall_nr].cell_nr = cell_nrs[t];
             }
-            else {
-                v.uv2.x = v.pos.x - min.x;
-                v.uv2.y = v.pos.y - min.y;
+        }
+    }
+}
+
+
+bool Map::cell_contains(const Sector& s, const SectorCell& cell, const glm::vec2& p) const {
+    for (int i = 0; i < (int) cell.edges.size(); ++i) {
+        const glm::vec2& a = s.walls[cell.edges[i].vert_nr].pos;
+        const glm::vec2& b = s.walls[cell.edges[(i + 1) % cell.edges.size()].vert_nr].pos;
+        if (cross(b - a, p - a) > 0) return false;
+    }
+    return true;
+}
+
+
+int Map::locate_cell(const Sector& s, const glm::vec2& p, int hint) const {
+    if (s.cells.empty()) return -1;
+
+    // walk through pseudo-portals from the hint, usually only a step or two
+    int nr = hint >= 0 && hint < (int) s.cells.size() ? hint : 0;
+    for (int steps = 0; steps < (int) s.cells.size(); ++steps) {
+        const SectorCell& cell = s.cells[nr];
+        int next = -1;
+        bool inside = true;
+        for (int i = 0; i < (int) cell.edges.size(); ++i) {
+            const glm::vec2& a = s.walls[cell.edges[i].vert_nr].pos;
+            const glm::vec2& b = s.walls[cell.edges[(i + 1) % cell.edges.size()].vert_nr].pos;
+            if (cross(b - a, p - a) <= 0) continue;
+            inside = false;
+            if (cell.edges[i].cell_nr >= 0) {
+                next = cell.edges[i].cell_nr;
+                break;
             }
-            v.uv2 *= SHADOW_DETAIL;
-            v.uv2 += glm::vec2(f.shadow.x, f.shadow.y) + glm::vec2(0.5);
-            v.uv2 /= Atlas::SURFACE_SIZE;
         }
+        if (inside) return nr;
+        if (next == -1) break;
+        nr = next;
+    }
 
+    // blocked by a wall, p is outside or around a corner
+    for (int i = 0; i < (int) s.cells.size(); ++i) {
+        if (cell_contains(s, s.cells[i], p)) return i;
     }
+    return -1;
 }
 
 
 bool Map::load(const char* name) {
-    FILE* f = fopen(name, "r");
+    FILE* f = fopen(name, "rb");
     if (!f) return false;
-    sectors.clear();
-    char line[4096];
-    while (fgets(line, sizeof(line), f)) {
-        sectors.emplace_back();
-        Sector& s = sectors.back();
-        float x, y;
-        int n;
-        char* p = line;
-        while (sscanf(p, "%f,%f%n", &x, &y, &n) == 2) {
-            p += n;
-            s.walls.push_back({ glm::vec2(x, y) });
-        }
-        assert(fscanf(f, "%f,%f\n", &s.floor_height, &s.ceil_height) == 2);
-    }
+    std::vector<Sector> loaded;
+    MapTextError error;
+    bool ok = read_map_text(f, loaded, error);
     fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Error: %s:%d:%d: %s\n", name, error.line, error.column, error.message);
+        return false;
+    }
+    sectors = std::move(loaded);
     setup_portals();
-
+    print_atlas_stats(shadow_atlas);
     return true;
 }
 
 
 bool Map::save(const char* name) const {
-    FILE* f = fopen(name, "w");
+    FILE* f = fopen(name, "wb");
     if (!f) return false;
-    for (const Sector& s : sectors) {
-        for (const Wall& w : s.walls) fprintf(f, " %.f,%.f", w.pos.x, w.pos.y);
-        fprintf(f, "\n %.f,%.f\n", s.floor_height, s.ceil_height);
+    bool ok = write_map_text(f, sectors);
+    return fclose(f) == 0 && ok;
+}
+
+
+bool Map::load_pmap(const char* name) {
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(pmap::Header)) {
+        close(fd);
+        return false;
     }
-    fclose(f);
+    size_t size = st.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    bool ok = load_pmap_data((const uint8_t*) data, size, true);
+    munmap(data, size);
+    if (!ok) {
+        fprintf(stderr, "Error: '%s' is not a valid pmap file\n", name);
+        return false;
+    }
+    print_atlas_stats(shadow_atlas);
     return true;
 }
 
 
+bool Map::load_pmap_data(const uint8_t* file, size_t size, bool resident) {
+    if (size < sizeof(pmap::Header)) return false;
+    const pmap::Header& h = *(const pmap::Header*) file;
+    bool ok = memcmp(h.magic, pmap::MAGIC, 4) == 0 && h.version == pmap::VERSION
+           && (int) h.shadow_atlas_size == shadow_atlas.get_surface_size();
+
+    // arrays that don't lie within the file leave a null pointer
+    auto array = [file, size, &ok](const pmap::Array& a, size_t elem_size) -> const void* {
+        if (!ok || a.offset % 8 != 0 || a.offset > size || a.count > (size - a.offset) / elem_size) {
+            ok = false;
+            return nullptr;
+        }
+        return file + a.offset;
+    };
+    auto ps = (const pmap::Sector*)  array(h.sectors, sizeof(pmap::Sector));
+    auto pw = (const pmap::Wall*)    array(h.walls,   sizeof(pmap::Wall));
+    auto pr = (const pmap::WallRef*) array(h.refs,    sizeof(pmap::WallRef));
+    auto pc = (const pmap::Cell*)    array(h.cells,   sizeof(pmap::Cell));
+    auto pe = (const pmap::Edge*)    array(h.edges,   sizeof(pmap::Edge));
+    auto pf = (const pmap::Face*)    array(h.faces,   sizeof(pmap::Face));
+    auto pv = (const pmap::Vertex*)  array(h.verts,   sizeof(pmap::Vertex));
+    auto pk = (const pmap::Chunk*)   array(h.chunks,  sizeof(pmap::Chunk));
+    array(h.texels, 1);
+
+    // every range and index is checked, a corrupt file must not be read out of bounds
+    auto in_range = [](uint64_t first, uint64_t count, uint64_t total) {
+        return first <= total && count <= total - first;
+    };
+    for (uint64_t i = 0; ok && i < h.sectors.count; ++i) {
+        ok = in_range(ps[i].first_wall, ps[i].wall_count, h.walls.count)
+          && in_range(ps[i].first_cell, ps[i].cell_count, h.cells.count)
+          && in_range(ps[i].first_face, ps[i].face_count, h.faces.count);
+    }
+    for (uint64_t i = 0; ok && i < h.walls.count; ++i) {
+        ok = in_range(pw[i].first_ref, pw[i].ref_count, h.refs.count);
+    }
+    for (uint64_t i = 0; ok && i < h.cells.count; ++i) {
+        ok = in_range(pc[i].first_edge, pc[i].edge_count, h.edges.count);
+    }
+    for (uint64_t i = 0; ok && i < h.faces.count; ++i) {
+        ok = in_range(pf[i].first_vert, pf[i].vert_count, h.verts.count);
+    }
+    for (uint64_t i = 0; ok && i < h.chunks.count; ++i) {
+        ok = in_range(pk[i].first_face, pk[i].face_count, h.faces.count)
+          && in_range(pk[i].first_vert, pk[i].vert_count, h.verts.count)
+          && in_range(pk[i].first_texel, pk[i].texel_count, h.texels.count);
+    }
+    // unchunked files put every sector into chunk 0
+    for (uint64_t i = 0; ok && i < h.sectors.count; ++i) {
+        ok = ps[i].chunk_nr < std::max<uint64_t>(h.chunks.count, 1);
+    }
+    auto in_index = [](int64_t nr, int64_t first, uint64_t count) {
+        return nr >= first && nr < (int64_t) count;
+    };
+    for (uint64_t i = 0; ok && i < h.sectors.count; ++i) {
+        const pmap::Sector& p = ps[i];
+        for (uint32_t j = 0; ok && j < p.wall_count; ++j) {
+            const pmap::Wall& w = pw[p.first_wall + j];
+            ok = in_index(w.cell_nr, -1, p.cell_count);
+            for (uint32_t k = 0; ok && k < w.ref_count; ++k) {
+                const pmap::WallRef& r = pr[w.first_ref + k];
+                ok = in_index(r.sector_nr, 0, h.sectors.count) && in_index(r.wall_nr, 0, ps[r.sector_nr].wall_count);
+            }
+        }
+        for (uint32_t j = 0; ok && j < p.cell_count; ++j) {
+            const pmap::Cell& c = pc[p.first_cell + j];
+            for (uint32_t k = 0; ok && k < c.edge_count; ++k) {
+                const pmap::Edge& e = pe[c.first_edge + k];
+                ok = in_index(e.vert_nr, 0, p.wall_count)
+                  && in_index(e.wall_nr, -1, p.wall_count)
+                  && in_index(e.cell_nr, -1, p.cell_count);
+            }
+        }
+    }
+    for (uint64_t i = 0; ok && i < h.faces.count; ++i) {
+        ok = in_index(pf[i].tex_nr, 0, MapFace::TEXTURE_COUNT);
+    }
+    ok = ok && (h.chunks.count == 0 || h.shadow_bytes_per_texel == (uint32_t) shadow_atlas.get_bytes_per_texel());
+    if (!ok) return false;
+
+    sectors.resize(h.sectors.count);
+    for (int i = 0; i < (int) sectors.size(); ++i) {
+        const pmap::Sector& p = ps[i];
+        Sector& s = sectors[i];
+        s.floor_height = p.floor_height;
+        s.ceil_height  = p.ceil_height;
+        s.min          = glm::vec2(p.min[0], p.min[1]);
+        s.max          = glm::vec2(p.max[0], p.max[1]);
+        s.first_face   = resident ? p.first_face : 0;
+        s.face_count   = resident ? p.face_count : 0;
+        s.face_key     = p.face_key;
+        s.walls.resize(p.wall_count);
+        for (int j = 0; j < (int) s.walls.size(); ++j) {
+            const pmap::Wall& w = pw[p.first_wall + j];
+            s.walls[j].pos     = glm::vec2(w.pos[0], w.pos[1]);
+            s.walls[j].cell_nr = w.cell_nr;
+            s.walls[j].refs.clear();
+            for (uint32_t k = 0; k < w.ref_count; ++k) {
+                s.walls[j].refs.push_back({ pr[w.first_ref + k].sector_nr, pr[w.first_ref + k].wall_nr });
+            }
+        }
+        s.cells.resize(p.cell_count);
+        for (int j = 0; j < (int) s.cells.size(); ++j) {
+            const pmap::Cell& c = pc[p.first_cell + j];
+            s.cells[j].edges.resize(c.edge_count);
+            for (uint32_t k = 0; k < c.edge_count; ++k) {
+                const pmap::Edge& e = pe[c.first_edge + k];
+                s.cells[j].edges[k] = { e.vert_nr, e.wall_nr, e.cell_nr };
+            }
+        }
+    }
+
+    // the regions of faces that aren't resident stay reserved for them
+    std::vector<AtlasRegion> regions(h.faces.count);
+    for (int i = 0; i < (int) regions.size(); ++i) {
+        const pmap::Face& p = pf[i];
+        regions[i] = { p.surface_nr, p.x, p.y, p.w, p.h, p.rotated != 0 };
+    }
+    faces.clear();
+    verts.clear();
+    if (resident) {
+        faces.resize(h.faces.count);
+        for (int i = 0; i < (int) faces.size(); ++i) faces[i] = pmap_face(pf[i]);
+        static_assert(sizeof(MapVertex) == sizeof(pmap::Vertex), "MapVertex doesn't match the pmap layout");
+        const MapVertex* mv = (const MapVertex*) pv;
+        verts.assign(mv, mv + h.verts.count);
+    }
+
+    if (!shadow_atlas.place(regions)) {
+        sectors.clear();
+        faces.clear();
+        verts.clear();
+        return false;
+    }
+    shadow_regions = regions;
+    ++revision;
+    return true;
+}
+
+
+bool Map::save_pmap(const char* name, float chunk_size) const {
+    // sectors go to the chunk their bounding box center lies in, unchunked files have a single chunk
+    std::vector<std::vector<int>> chunk_sectors(1);
+    std::vector<uint32_t> chunk_nrs(sectors.size(), 0);
+    if (chunk_size > 0) {
+        std::map<std::pair<int, int>, int> chunk_map;
+        chunk_sectors.clear();
+        for (int i = 0; i < (int) sectors.size(); ++i) {
+            glm::ivec2 c = glm::floor((sectors[i].min + sectors[i].max) * 0.5f / chunk_size);
+            auto it = chunk_map.emplace(std::make_pair(c.x, c.y), (int) chunk_sectors.size()).first;
+            if (it->second == (int) chunk_sectors.size()) chunk_sectors.emplace_back();
+            chunk_sectors[it->second].push_back(i);
+            chunk_nrs[i] = it->second;
+        }
+    }
+    else {
+        for (int i = 0; i < (int) sectors.size(); ++i) chunk_sectors[0].push_back(i);
+    }
+
+    std::vector<pmap::Sector>  ps;
+    std::vector<pmap::Wall>    pw;
+    std::vector<pmap::WallRef> pr;
+    std::vector<pmap::Cell>    pc;
+    std::vector<pmap::Edge>    pe;
+    std::vector<pmap::Face>    pf;
+    std::vector<pmap::Chunk>   pk;
+    std::vector<uint8_t>       pt;
+
+    for (int i = 0; i < (int) sectors.size(); ++i) {
+        const Sector& s = sectors[i];
+        pmap::Sector p = {};
+        p.floor_height = s.floor_height;
+        p.ceil_height  = s.ceil_height;
+        p.min[0]       = s.min.x;
+        p.min[1]       = s.min.y;
+        p.max[0]       = s.max.x;
+        p.max[1]       = s.max.y;
+        p.first_wall   = pw.size();
+        p.wall_count   = s.walls.size();
+        p.first_cell   = pc.size();
+        p.cell_count   = s.cells.size();
+        p.face_key     = s.face_key;
+        p.chunk_nr     = chunk_nrs[i];
+        ps.push_back(p);
+
+        for (const Wall& w : s.walls) {
+            pw.push_back({ { w.pos.x, w.pos.y }, w.cell_nr, uint32_t(pr.size()), uint32_t(w.refs.size()) });
+            for (const WallRef& r : w.refs) pr.push_back({ r.sector_nr, r.wall_nr });
+        }
+        for (const SectorCell& c : s.cells) {
+            pc.push_back({ uint32_t(pe.size()), uint32_t(c.edges.size()) });
+            for (const SectorCell::Edge& e : c.edges) pe.push_back({ e.vert_nr, e.wall_nr, e.cell_nr });
+        }
+    }
+
+    // faces and vertices are written compacted, grouped by chunk.
+    // vertices go straight from the arena to the file, they are by far the largest array
+    uint32_t vert_count = 0;
+    for (const std::vector<int>& cs : chunk_sectors) {
+        pmap::Chunk k = {};
+        glm::vec2 min(std::numeric_limits<float>::max());
+        glm::vec2 max(-std::numeric_limits<float>::max());
+        k.first_face  = pf.size();
+        k.first_vert  = vert_count;
+        k.first_texel = pt.size();
+        for (int i : cs) {
+            const Sector& s = sectors[i];
+            min = glm::min(min, s.min);
+            max = glm::max(max, s.max);
+            ps[i].first_face = pf.size();
+            ps[i].face_count = s.face_count;
+            for (const MapFace& f : get_faces(s)) {
+                pf.push_back({ { f.normal.x, f.normal.y, f.normal.z }, f.tex_nr,
+                               f.shadow.surface_nr, f.shadow.x, f.shadow.y, f.shadow.w, f.shadow.h,
+                               f.shadow.rotated, vert_count, uint32_t(f.vert_count) });
+                vert_count += f.vert_count;
+                if (chunk_size > 0) {
+                    size_t bytes = f.shadow.w * f.shadow.h * shadow_atlas.get_bytes_per_texel();
+                    pt.resize(pt.size() + bytes);
+                    shadow_atlas.read_region(f.shadow, pt.data() + pt.size() - bytes);
+                }
+            }
+        }
+        k.min[0]      = min.x;
+        k.min[1]      = min.y;
+        k.max[0]      = max.x;
+        k.max[1]      = max.y;
+        k.face_count  = pf.size() - k.first_face;
+        k.vert_count  = vert_count - k.first_vert;
+        k.texel_count = pt.size() - k.first_texel;
+        pk.push_back(k);
+    }
+    if (chunk_size <= 0) pk.clear();
+
+    pmap::Header h = {};
+    memcpy(h.magic, pmap::MAGIC, 4);
+    h.version           = pmap::VERSION;
+    h.shadow_atlas_size = shadow_atlas.get_surface_size();
+    h.shadow_bytes_per_texel = shadow_atlas.get_bytes_per_texel();
+
+    uint64_t offset = sizeof(h);
+    auto place = [&offset](pmap::Array& a, size_t count, size_t elem_size) {
+        a.offset = offset;
+        a.count  = count;
+        offset  += (count * elem_size + 7) & ~7;
+    };
+    place(h.sectors, ps.size(), sizeof(pmap::Sector));
+    place(h.walls,   pw.size(), sizeof(pmap::Wall));
+    place(h.refs,    pr.size(), sizeof(pmap::WallRef));
+    place(h.cells,   pc.size(), sizeof(pmap::Cell));
+    place(h.edges,   pe.size(), sizeof(pmap::Edge));
+    place(h.faces,   pf.size(), sizeof(pmap::Face));
+    place(h.verts,   vert_count, sizeof(pmap::Vertex));
+    place(h.chunks,  pk.size(), sizeof(pmap::Chunk));
+    place(h.texels,  pt.size(), 1);
+
+    FILE* f = fopen(name, "wb");
+    if (!f) return false;
+    auto write = [f](const void* data, size_t size) {
+        static const char zeros[8] = {};
+        fwrite(data, 1, size, f);
+        fwrite(zeros, 1, -size & 7, f);
+    };
+    write(&h, sizeof(h));
+    write(ps.data(), ps.size() * sizeof(pmap::Sector));
+    write(pw.data(), pw.size() * sizeof(pmap::Wall));
+    write(pr.data(), pr.size() * sizeof(pmap::WallRef));
+    write(pc.data(), pc.size() * sizeof(pmap::Cell));
+    write(pe.data(), pe.size() * sizeof(pmap::Edge));
+    write(pf.data(), pf.size() * sizeof(pmap::Face));
+    for (const std::vector<int>& cs : chunk_sectors) {
+        for (int i : cs) {
+            for (const MapFace& face : get_faces(sectors[i])) {
+                Span<const MapVertex> vs = get_verts(face);
+                fwrite(vs.begin(), sizeof(MapVertex), vs.size(), f);
+            }
+        }
+    }
+    write(pk.data(), pk.size() * sizeof(pmap::Chunk));
+    write(pt.data(), pt.size());
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+
+void Map::sort_refs(std::vector<WallRef>& refs) const {
+    // faces depend on the order, so it must not depend on the order the links were made in
+    std::sort(refs.begin(), refs.end(), [this](const WallRef& r1, const WallRef& r2) {
+        const Sector& s1 = sectors[r1.sector_nr];
+        const Sector& s2 = sectors[r2.sector_nr];
+        if (s1.floor_height != s2.floor_height) return s1.floor_height > s2.floor_height;
+        if (s1.ceil_height != s2.ceil_height) return s1.ceil_height > s2.ceil_height;
+        return r1 < r2;
+    });
+}
+
+
+static long long region_key(const AtlasRegion& r) {
+    return (long long) r.surface_nr << 32 | r.y << 16 | r.x;
+}
+
+
 void Map::setup_portals() {
+    auto start = std::chrono::steady_clock::now();
     for (Sector& sector : sectors) {
         for (Wall& wall : sector.walls) wall.refs.clear();
 
@@ -397,39 +967,431 @@ void Map::setup_portals() {
                 Wall& w = s.walls[ref.wall_nr];
                 w.refs.push_back({ i, j });
                 w1.refs.push_back(ref);
+                sort_refs(w.refs);
+                sort_refs(w1.refs);
+            }
 
-                // sort refs top to bottom
-                auto cmp = [this](const WallRef& r1, const WallRef& r2){
-                    Sector s1 = sectors[r1.sector_nr];
-                    Sector s2 = sectors[r2.sector_nr];
-                    return s1.floor_height > s2.floor_height;
-                };
-                std::sort(w.refs.begin(), w.refs.end(), cmp);
-                std::sort(w1.refs.begin(), w1.refs.end(), cmp);
+        }
+    }
+
+    auto linked = std::chrono::steady_clock::now();
+
+    // only sectors whose faces would come out differently are rebuilt,
+    // all other faces keep their place in the shadow atlas
+    std::vector<int> dirty;
+    for (int i = 0; i < (int) sectors.size(); ++i) {
+        Sector& s = sectors[i];
+        size_t key = sector_face_key(s);
+        if (key == s.face_key && s.face_count > 0) continue;
+        s.face_key = key;
+        s.face_count = 0;
+        dirty.push_back(i);
+    }
+
+    if (dirty.size() == sectors.size()) {
+        faces.clear();
+        verts.clear();
+        setup_faces(dirty);
+        pack_shadow_atlas();
+    }
+    else {
+        // release the regions of rebuilt and deleted sectors
+        std::unordered_set<long long> kept;
+        for (const Sector& s : sectors) {
+            for (const MapFace& f : get_faces(s)) kept.insert(region_key(f.shadow));
+        }
+        for (const AtlasRegion& r : shadow_regions) {
+            if (!kept.count(region_key(r))) shadow_atlas.free_region(r);
+        }
+
+        setup_faces(dirty);
+        for (int i : dirty) {
+            for (MapFace& f : get_faces(sectors[i])) {
+                set_face_region(f, shadow_atlas.allocate_region(f.shadow.w, f.shadow.h, true));
             }
+        }
+        compact_faces();
+    }
+
+    shadow_regions.clear();
+    for (const Sector& s : sectors) {
+        for (const MapFace& f : get_faces(s)) shadow_regions.push_back(f.shadow);
+    }
+    ++revision;
+
+    std::chrono::duration<double, std::milli> link_ms = linked - start;
+    std::chrono::duration<double, std::milli> faces_ms = std::chrono::steady_clock::now() - linked;
+    setup_stats.calls           += 1;
+    setup_stats.rebuilt_sectors += dirty.size();
+    setup_stats.link_ms         += link_ms.count();
+    setup_stats.faces_ms        += faces_ms.count();
+}
+
+
+// shifted as unsigned like WallGrid's keys, cells left of the origin have a negative x
+static unsigned long long sector_cell_key(int x, int y) {
+    return (unsigned long long) (uint32_t) x << 32 | (uint32_t) y;
+}
+
+
+template <class Func>
+void Map::for_sector_cells(const glm::vec2& min, const glm::vec2& max, Func f) {
+    glm::ivec2 c1 = glm::floor(min / SECTOR_GRID_CELL_SIZE);
+    glm::ivec2 c2 = glm::floor(max / SECTOR_GRID_CELL_SIZE);
+    for (int y = c1.y; y <= c2.y; ++y)
+    for (int x = c1.x; x <= c2.x; ++x) {
+        auto it = sector_grid.find(sector_cell_key(x, y));
+        if (it != sector_grid.end()) f(it->second);
+    }
+}
+
+
+void Map::grid_insert(int sector_nr) {
+    const Sector& s = sectors[sector_nr];
+    glm::ivec2 c1 = glm::floor(s.min / SECTOR_GRID_CELL_SIZE);
+    glm::ivec2 c2 = glm::floor(s.max / SECTOR_GRID_CELL_SIZE);
+    for (int y = c1.y; y <= c2.y; ++y)
+    for (int x = c1.x; x <= c2.x; ++x) {
+        sector_grid[sector_cell_key(x, y)].push_back(sector_nr);
+    }
+}
+
+
+void Map::grid_remove(int sector_nr) {
+    const Sector& s = sectors[sector_nr];
+    for_sector_cells(s.min, s.max, [sector_nr](std::vector<int>& cell) {
+        auto it = std::find(cell.begin(), cell.end(), sector_nr);
+        if (it == cell.end()) return;
+        *it = cell.back();
+        cell.pop_back();
+    });
+}
+
+
+void Map::build_sector_grid() {
+    sector_grid.clear();
+    for (int i = 0; i < (int) sectors.size(); ++i) grid_insert(i);
+    sector_grid_revision = revision;
+}
+
+
+void Map::relink_sectors(const std::vector<int>& sector_nrs) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> changed;
+    for (int i : sector_nrs) {
+        if (i >= 0 && i < (int) sectors.size()) changed.push_back(i);
+    }
+    // nothing changed, so the revision stays and nobody rebuilds anything
+    if (changed.empty()) return;
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    // the bounding boxes in the grid are still those of before the change
+    if (sector_grid_revision != revision) build_sector_grid();
+    std::unordered_set<int> is_changed(changed.begin(), changed.end());
+
+    for (int i : changed) {
+        Sector& sector = sectors[i];
+        for (Wall& wall : sector.walls) wall.refs.clear();
+        for (int j = 0; j < (int) sector.walls.size();) {
+            Wall& w1 = sector.walls[j];
+            Wall& w2 = sector.walls[(j + 1) % sector.walls.size()];
+            if (w1.pos == w2.pos) sector.walls.erase(sector.walls.begin() + j);
+            else ++j;
+        }
+    }
+
+    // whose links change may need new faces
+    std::unordered_set<int> touched(changed.begin(), changed.end());
+
+    // old neighbours overlap the old bounding boxes, their links into changed sectors go
+    for (int i : changed) {
+        const Sector& sector = sectors[i];
+        for_sector_cells(sector.min, sector.max, [&](std::vector<int>& cell) {
+            for (int nr : cell) {
+                if (is_changed.count(nr)) continue;
+                for (Wall& w : sectors[nr].walls) {
+                    auto it = std::remove_if(w.refs.begin(), w.refs.end(), [&](const WallRef& ref) {
+                        return is_changed.count(ref.sector_nr) > 0;
+                    });
+                    if (it == w.refs.end()) continue;
+                    w.refs.erase(it, w.refs.end());
+                    touched.insert(nr);
+                }
+            }
+        });
+    }
+
+    auto link = [&](const WallRef& a, const WallRef& b) {
+        Sector& sa = sectors[a.sector_nr];
+        Sector& sb = sectors[b.sector_nr];
+        if (sa.floor_height >= sb.ceil_height || sa.ceil_height <= sb.floor_height) return;
+        Wall& wa = sa.walls[a.wall_nr];
+        Wall& wb = sb.walls[b.wall_nr];
+        wa.refs.push_back(b);
+        wb.refs.push_back(a);
+        sort_refs(wa.refs);
+        sort_refs(wb.refs);
+        touched.insert(b.sector_nr);
+    };
+
+    std::unordered_map<std::pair<glm::vec2, glm::vec2>, std::vector<WallRef>> own_walls;
+    for (int i : changed) {
+        const Sector& sector = sectors[i];
+        for (int j = 0; j < (int) sector.walls.size(); ++j) {
+            const Wall& w1 = sector.walls[j];
+            const Wall& w2 = sector.walls[(j + 1) % sector.walls.size()];
+            own_walls[std::make_pair(w1.pos, w2.pos)].push_back({ i, j });
+        }
+    }
+    for (int i : changed) {
+        const Sector& sector = sectors[i];
+        for (int j = 0; j < (int) sector.walls.size(); ++j) {
+            glm::vec2 p1 = sector.walls[j].pos;
+            glm::vec2 p2 = sector.walls[(j + 1) % sector.walls.size()].pos;
+            WallRef ref = { i, j };
+
+            // between changed sectors, each pair once
+            auto it = own_walls.find(std::make_pair(p2, p1));
+            if (it != own_walls.end()) {
+                for (const WallRef& other : it->second) {
+                    if (ref < other) link(ref, other);
+                }
+            }
+
+            // new neighbours have p1 in their bounding box
+            for_sector_cells(p1, p1, [&](std::vector<int>& cell) {
+                for (int nr : cell) {
+                    if (is_changed.count(nr)) continue;
+                    const Sector& s = sectors[nr];
+                    for (int k = 0; k < (int) s.walls.size(); ++k) {
+                        if (s.walls[k].pos != p2 || s.walls[(k + 1) % s.walls.size()].pos != p1) continue;
+                        link(ref, { nr, k });
+                    }
+                }
+            });
+        }
+    }
+
+    auto linked = std::chrono::steady_clock::now();
+
+    std::vector<int> candidates(touched.begin(), touched.end());
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<int> dirty;
+    std::unordered_set<long long> freed;
+    std::vector<bool> freed_surface(shadow_atlas.get_surface_count());
+    for (int i : candidates) {
+        Sector& s = sectors[i];
+        size_t key = sector_face_key(s);
+        if (key == s.face_key && s.face_count > 0) continue;
+        for (const MapFace& f : get_faces(s)) {
+            shadow_atlas.free_region(f.shadow);
+            freed.insert(region_key(f.shadow));
+            freed_surface[f.shadow.surface_nr] = true;
+        }
+        s.face_key = key;
+        s.face_count = 0;
+        dirty.push_back(i);
+    }
+
+    // rebuilding moves the bounding boxes
+    for (int i : changed) grid_remove(i);
+    setup_faces(dirty);
+    for (int i : dirty) {
+        for (MapFace& f : get_faces(sectors[i])) {
+            set_face_region(f, shadow_atlas.allocate_region(f.shadow.w, f.shadow.h, true));
+        }
+    }
+    compact_faces();
+    for (int i : changed) grid_insert(i);
+
+    // freed regions sit on a few surfaces, regions on the others are passed over without a lookup
+    for (int k = 0; k < (int) shadow_regions.size() && !freed.empty();) {
+        const AtlasRegion& r = shadow_regions[k];
+        if (r.surface_nr < (int) freed_surface.size() && freed_surface[r.surface_nr]
+        &&  freed.erase(region_key(r))) {
+            shadow_regions[k] = shadow_regions.back();
+            shadow_regions.pop_back();
+        }
+        else ++k;
+    }
+    for (int i : dirty) {
+        for (const MapFace& f : get_faces(sectors[i])) shadow_regions.push_back(f.shadow);
+    }
+    sector_grid_revision = ++revision;
+
+    std::chrono::duration<double, std::milli> link_ms = linked - start;
+    std::chrono::duration<double, std::milli> faces_ms = std::chrono::steady_clock::now() - linked;
+    setup_stats.calls           += 1;
+    setup_stats.rebuilt_sectors += dirty.size();
+    setup_stats.link_ms         += link_ms.count();
+    setup_stats.faces_ms        += faces_ms.count();
+}
+
 
+void Map::setup_faces(const std::vector<int>& sector_nrs) {
+    int n = sector_nrs.size();
+    if (n <= FACE_JOB_SECTORS) {
+        for (int i : sector_nrs) setup_sector_faces(sectors[i]);
+        return;
+    }
+
+    // every job builds a run of sectors into arenas of its own, which are then
+    // appended in order. the result is the same as building one sector after the other.
+    struct Chunk {
+        std::vector<MapFace>   faces;
+        std::vector<MapVertex> verts;
+    };
+    std::vector<Chunk> chunks((n + FACE_JOB_SECTORS - 1) / FACE_JOB_SECTORS);
+    jobs.parallel_for(0, n, FACE_JOB_SECTORS, [&](int first, int last) {
+        Chunk& c = chunks[first / FACE_JOB_SECTORS];
+        for (int k = first; k < last; ++k) setup_sector_faces(sectors[sector_nrs[k]], c.faces, c.verts);
+    });
+
+    size_t face_count = faces.size();
+    size_t vert_count = verts.size();
+    for (const Chunk& c : chunks) {
+        face_count += c.faces.size();
+        vert_count += c.verts.size();
+    }
+    faces.reserve(face_count);
+    verts.reserve(vert_count);
+    for (int c = 0; c < (int) chunks.size(); ++c) {
+        Chunk& chunk = chunks[c];
+        for (MapFace& f : chunk.faces) f.first_vert += verts.size();
+        int last = std::min(n, (c + 1) * FACE_JOB_SECTORS);
+        for (int k = c * FACE_JOB_SECTORS; k < last; ++k) sectors[sector_nrs[k]].first_face += faces.size();
+        faces.insert(faces.end(), chunk.faces.begin(), chunk.faces.end());
+        verts.insert(verts.end(), chunk.verts.begin(), chunk.verts.end());
+        chunk = Chunk();
+    }
+}
+
+
+void Map::compact_faces() {
+    // leave garbage until it makes up half of the arenas
+    int live = 0;
+    for (const Sector& s : sectors) live += s.face_count;
+    if (live * 2 > (int) faces.size()) return;
+
+    int live_verts = 0;
+    for (const Sector& s : sectors) {
+        for (const MapFace& f : get_faces(s)) live_verts += f.vert_count;
+    }
+    std::vector<MapFace> new_faces;
+    std::vector<MapVertex> new_verts;
+    new_faces.reserve(live);
+    new_verts.reserve(live_verts);
+    for (Sector& s : sectors) {
+        int first_face = new_faces.size();
+        for (const MapFace& f : get_faces(s)) {
+            new_faces.push_back(f);
+            new_faces.back().first_vert = new_verts.size();
+            Span<const MapVertex> vs = get_verts(f);
+            new_verts.insert(new_verts.end(), vs.begin(), vs.end());
+        }
+        s.first_face = first_face;
+    }
+    faces.swap(new_faces);
+    verts.swap(new_verts);
+}
+
+
+size_t Map::sector_face_key(const Sector& s) const {
+    size_t key = 0;
+    auto mix = [&key](float v) { key ^= std::hash<float>()(v) + 0x9e3779b9 + (key << 6) + (key >> 2); };
+    mix(s.floor_height);
+    mix(s.ceil_height);
+    for (const Wall& w : s.walls) {
+        mix(w.pos.x);
+        mix(w.pos.y);
+        mix(w.refs.size());
+        for (const WallRef& ref : w.refs) {
+            mix(sectors[ref.sector_nr].floor_height);
+            mix(sectors[ref.sector_nr].ceil_height);
         }
     }
+    return key;
+}
+
+
+void Map::defragment_shadow_atlas(int max_moves) {
+    std::unordered_map<long long, MapFace*> region_faces;
+    for (const Sector& s : sectors) {
+        for (MapFace& f : get_faces(s)) region_faces[region_key(f.shadow)] = &f;
+    }
+    // regions of faces that are paged out can't be moved
+    if (region_faces.size() != shadow_regions.size()) return;
+    bool moved = shadow_atlas.defragment(max_moves, [&](const AtlasRegion& from, const AtlasRegion& to) {
+        MapFace& f = *region_faces[region_key(from)];
+        f.shadow = to;
+        float surface_size = shadow_atlas.get_surface_size();
+        glm::vec3 delta = glm::vec3(to.x - from.x, to.y - from.y, 0) / surface_size;
+        delta.z = to.surface_nr - from.surface_nr;
+        for (MapVertex& v : get_verts(f)) v.uv2 += delta;
+    });
+    if (!moved) return;
+    shadow_regions.clear();
+    for (const Sector& s : sectors) {
+        for (const MapFace& f : get_faces(s)) shadow_regions.push_back(f.shadow);
+    }
+}
+
+
+void Map::pack_shadow_atlas() {
+    std::vector<AtlasRegion> regions;
+    regions.reserve(faces.size());
+    for (const MapFace& f : faces) regions.push_back(f.shadow);
 
     shadow_atlas.init();
-    for (Sector& s : sectors) setup_sector_faces(s);
+    shadow_atlas.pack(regions);
+
+    jobs.parallel_for(0, faces.size(), FACE_JOB_FACES, [&](int first, int last) {
+        for (int i = first; i < last; ++i) set_face_region(faces[i], regions[i]);
+    });
+}
+
+
+void Map::set_face_region(MapFace& f, const AtlasRegion& r) {
+    // vertex uvs are still in texels relative to the unrotated region
+    f.shadow = r;
+    float surface_size = shadow_atlas.get_surface_size();
+    for (MapVertex& v : get_verts(f)) {
+        glm::vec2 uv(v.uv2);
+        if (r.rotated) std::swap(uv.x, uv.y);
+        uv += glm::vec2(r.x, r.y) + glm::vec2(0.5);
+        v.uv2 = glm::vec3(uv / surface_size, r.surface_nr);
+    }
+}
+
+
+void Map::get_sector_order(int sector_nr, std::vector<int>& order) const {
+    order.clear();
+    std::vector<bool> visited(sectors.size());
+    if (sector_nr != -1) {
+        visited[sector_nr] = true;
+        order.push_back(sector_nr);
+    }
+    // order doubles as the queue
+    for (int i = 0; i < (int) order.size(); ++i) {
+        for (const Wall& w : sectors[order[i]].walls) {
+            for (const WallRef& r : w.refs) {
+                if (visited[r.sector_nr]) continue;
+                visited[r.sector_nr] = true;
+                order.push_back(r.sector_nr);
+            }
+        }
+    }
+    for (int i = 0; i < (int) sectors.size(); ++i) {
+        if (!visited[i]) order.push_back(i);
+    }
 }
 
 
 int Map::pick_sector(const glm::vec2& p) const {
     for (int i = 0; i < (int) sectors.size(); ++i) {
         const Sector& s = sectors[i];
-        bool success = false;
-        for (int j = 0; j < (int) s.walls.size(); ++j) {
-            const glm::vec2& w1 = s.walls[j].pos;
-            const glm::vec2& w2 = s.walls[(j + 1) % s.walls.size()].pos;
-            glm::vec2 ww = w2 - w1;
-            glm::vec2 pw = p - w1;
-            if ((w1.y <= p.y) == (w2.y > p.y) && (pw.x < ww.x * pw.y / ww.y)) {
-                success = !success;
-            }
-        }
-        if (success) return i;
+        if (point_in_rect(p, s.min, s.max) && locate_cell(s, p, 0) >= 0) return i;
     }
     return -1;
 }
@@ -445,42 +1407,62 @@ void Map::clip_move(Location& loc, const glm::vec3& mov) const {
     glm::vec3 new_pos = loc.pos;
 
     // ignore height movement
-    std::vector<int> visited;
-    std::queue<int> todo({ loc.sector_nr });
     new_pos.x += mov.x;
     new_pos.z += mov.z;
     glm::vec2 pos(new_pos.x, new_pos.z);
+
+    // walk the cells within radius, starting where the hint and the old position agree
+    const Sector& start = sectors[loc.sector_nr];
+    int start_cell = locate_cell(start, pos, loc.cell_nr);
+    if (start_cell == -1) start_cell = locate_cell(start, glm::vec2(loc.pos.x, loc.pos.z), loc.cell_nr);
+    if (start_cell == -1) start_cell = 0;
+
+    std::vector<int> visited_sectors;
+    std::vector<std::pair<int, int>> visited;
+    std::queue<std::pair<int, int>> todo;
+    auto push = [&](int sector_nr, int cell_nr) {
+        std::pair<int, int> c(sector_nr, cell_nr);
+        if (cell_nr < 0 || std::find(visited.begin(), visited.end(), c) != visited.end()) return;
+        visited.push_back(c);
+        todo.push(c);
+        if (std::find(visited_sectors.begin(), visited_sectors.end(), sector_nr) == visited_sectors.end()) {
+            visited_sectors.push_back(sector_nr);
+        }
+    };
+    push(loc.sector_nr, start_cell);
     while (!todo.empty()) {
-        int nr = todo.front();
+        std::pair<int, int> c = todo.front();
         todo.pop();
-        if (nr == -1) continue;
-        visited.push_back(nr);
-        const Sector& s = map.sectors[nr];
-
-        for (int j = 0; j < (int) s.walls.size(); ++j) {
-            const Wall& w = s.walls[j];
-            const Wall& w2 = s.walls[(j + 1) % s.walls.size()];
-            glm::vec2 ww = w2.pos - w.pos;
-            glm::vec2 pw = pos - w.pos;
+        const Sector& s = sectors[c.first];
+        if (c.second >= (int) s.cells.size()) continue;
+        const SectorCell& cell = s.cells[c.second];
+
+        for (int j = 0; j < (int) cell.edges.size(); ++j) {
+            const SectorCell::Edge& e = cell.edges[j];
+            const glm::vec2& w1 = s.walls[e.vert_nr].pos;
+            const glm::vec2& w2 = s.walls[cell.edges[(j + 1) % cell.edges.size()].vert_nr].pos;
+            glm::vec2 ww = w2 - w1;
+            glm::vec2 pw = pos - w1;
 
             float u = glm::dot(pw, ww) / glm::length2(ww);
             u = std::max(0.0f, std::min(1.0f, u));
-            glm::vec2 p = w.pos + ww * u; // p is the point on the wall that is closest to pos
+            glm::vec2 p = w1 + ww * u; // p is the point on the edge that is closest to pos
             glm::vec2 normal = pos - p;
             float dst = glm::length(normal);
             if (dst < radius) {
 
+                if (e.wall_nr == -1) {
+                    push(c.first, e.cell_nr);
+                    continue;
+                }
 
                 bool pass = false;
-                for (const WallRef& r : w.refs) {
+                for (const WallRef& r : s.walls[e.wall_nr].refs) {
                     const Sector& s2 = sectors[r.sector_nr];
                     if (new_pos.y + ceil_dist <= s2.ceil_height
                     &&  new_pos.y - floor_dist >= s2.floor_height) {
                         pass = true;
-
-                        if (std::find(visited.begin(), visited.end(), r.sector_nr) == visited.end()) {
-                            todo.push(r.sector_nr);
-                        }
+                        push(r.sector_nr, s2.walls[r.wall_nr].cell_nr);
                         break;
                     }
                 }
@@ -498,8 +1480,8 @@ void Map::clip_move(Location& loc, const glm::vec3& mov) const {
 
     // handle height
     new_pos.y += mov.y;
-    for (int nr : visited) {
-        const Sector& sector = map.sectors[nr];
+    for (int nr : visited_sectors) {
+        const Sector& sector = sectors[nr];
         // clamp height
         if (new_pos.y - floor_dist < sector.floor_height)    new_pos.y = sector.floor_height + floor_dist;
         if (new_pos.y + ceil_dist > sector.ceil_height)        new_pos.y = sector.ceil_height - ceil_dist;
@@ -508,9 +1490,11 @@ void Map::clip_move(Location& loc, const glm::vec3& mov) const {
 
     WallRef ref;
     glm::vec3 normal;
+    int cell_nr;
 
-    ray_intersect(loc, new_pos - loc.pos, ref, normal, 1);
+    trace(loc, new_pos - loc.pos, ref, normal, 1, cell_nr);
     loc.sector_nr = ref.sector_nr;
+    loc.cell_nr = cell_nr;
     loc.pos = new_pos;
 
 }
@@ -519,33 +1503,68 @@ void Map::clip_move(Location& loc, const glm::vec3& mov) const {
 float Map::ray_intersect(const Location& loc, const glm::vec3& dir,
                          WallRef& ref, glm::vec3& normal, float max_factor) const
 {
+    int cell_nr;
+    return trace(loc, dir, ref, normal, max_factor, cell_nr);
+}
+
+
+float Map::trace(const Location& loc, const glm::vec3& dir,
+                 WallRef& ref, glm::vec3& normal, float max_factor, int& cell_nr) const
+{
 
     ref.sector_nr = loc.sector_nr;
     ref.wall_nr = 0;
-    float min_factor = 0;
     glm::vec2 p(loc.pos.x, loc.pos.z);
     glm::vec2 d(dir.x, dir.z);
 
-    for (;;) {
+    const Sector& start = sectors[loc.sector_nr];
+    cell_nr = locate_cell(start, p, loc.cell_nr);
+    if (cell_nr == -1) cell_nr = std::max(0, std::min<int>(loc.cell_nr, start.cells.size() - 1));
+    if (start.cells.empty()) return max_factor;
+
+    // a convex cell is left through the nearest edge facing along the ray
+    for (int steps = 0;; ++steps) {
         const Sector& s = sectors[ref.sector_nr];
+        const SectorCell& cell = s.cells[cell_nr];
+        // cells keep collinear edges, so the hit has to lie on the edge.
+        // the nearest line only counts when rounding lets the ray slip past a vertex
         float factor = max_factor;
-        for (int i = 0; i < (int) s.walls.size(); ++i) {
-            const Wall& w1 = s.walls[i];
-            const Wall& w2 = s.walls[(i + 1) % s.walls.size()];
-            glm::vec2 ww = w2.pos - w1.pos;
-            glm::vec2 pw = p - w1.pos;
+        float line_factor = max_factor;
+        int edge_nr = -1;
+        int line_nr = -1;
+        for (int i = 0; i < (int) cell.edges.size(); ++i) {
+            const glm::vec2& w1 = s.walls[cell.edges[i].vert_nr].pos;
+            const glm::vec2& w2 = s.walls[cell.edges[(i + 1) % cell.edges.size()].vert_nr].pos;
+            glm::vec2 ww = w2 - w1;
+            glm::vec2 pw = p - w1;
             float c = cross(ww, d);
             if (c <= 0) continue;
             float t = cross(pw, d) / c;
             float u = cross(pw, ww) / c;
-            if (u > min_factor && u < factor && t >= 0 && t <= 1) {
+            if (u < line_factor) {
+                line_factor = u;
+                line_nr = i;
+            }
+            if (u < factor && t >= 0 && t <= 1) {
                 factor = u;
-                ref.wall_nr = i;
-                normal = glm::vec3(ww.y, 0, -ww.x);
+                edge_nr = i;
             }
         }
+        if (edge_nr == -1) {
+            factor = line_factor;
+            edge_nr = line_nr;
+        }
 
-        if (factor == max_factor) return max_factor;
+        if (edge_nr == -1) return max_factor;
+        glm::vec2 ww = s.walls[cell.edges[(edge_nr + 1) % cell.edges.size()].vert_nr].pos
+                     - s.walls[cell.edges[edge_nr].vert_nr].pos;
+        normal = glm::vec3(ww.y, 0, -ww.x);
+
+        const SectorCell::Edge& e = cell.edges[edge_nr];
+        if (e.wall_nr == -1) {
+            cell_nr = e.cell_nr;
+            continue;
+        }
 
         float y = loc.pos.y + dir.y * factor;
 
@@ -564,18 +1583,19 @@ float Map::ray_intersect(const Location& loc, const glm::vec3& dir,
             return factor;
         }
 
-        const Wall& w = s.walls[ref.wall_nr];
+        ref.wall_nr = e.wall_nr;
         bool portal = false;
-        for (const WallRef& r : w.refs) {
+        for (const WallRef& r : s.walls[e.wall_nr].refs) {
             const Sector& s2 = sectors[r.sector_nr];
-            if (y < s2.ceil_height && y > s2.floor_height) {
+            if (y < s2.ceil_height && y > s2.floor_height && s2.walls[r.wall_nr].cell_nr >= 0) {
                 ref = r;
+                cell_nr = s2.walls[r.wall_nr].cell_nr;
                 portal = true;
-                min_factor = factor;
                 break;
             }
         }
-        if (!portal) {
+        // the step limit only guards against broken sectors
+        if (!portal || steps > 4096) {
             normal = glm::normalize(normal);
             return factor;
         }
@@ -583,5 +1603,4 @@ float Map::ray_intersect(const Location& loc, const glm::vec3& dir,
     return 0;
 }
 
-
 Map map;
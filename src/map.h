@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <unordered_map>
 #include <glm/glm.hpp>
 
 #include "atlas.h"
@@ -9,26 +10,52 @@
 struct MapVertex {
 	glm::vec3		pos;
 	glm::vec2		uv;
-	glm::vec2		uv2;
-	MapVertex(const glm::vec3& pos, const glm::vec2& uv, const glm::vec2& uv2=glm::vec2(0, 0))
+	glm::vec3		uv2;	// shadow atlas uv and surface nr
+	MapVertex(const glm::vec3& pos, const glm::vec2& uv, const glm::vec3& uv2=glm::vec3(0, 0, 0))
 		: pos(pos), uv(uv), uv2(uv2)
 	{}
 };
 
 
+// faces and their vertices live in the map's arenas
 struct MapFace {
+	enum { TEXTURE_COUNT = 3 };	// walls, floors, ceilings
 	glm::vec3				normal;
-	glm::mat4				mat;
-	glm::mat4				inv_mat;
 	int						tex_nr;
 	AtlasRegion				shadow;
-	std::vector<MapVertex>	verts;
+	int						first_vert;
+	int						vert_count;
+};
+
+namespace pmap { struct Face; }
+// first_vert is taken over as is
+MapFace pmap_face(const pmap::Face& p);
+
+
+// face space to world space, only needed for baking
+struct FaceTransform {
+	glm::mat4				mat;
+	glm::mat4				inv_mat;
+};
+
+
+// view into one of the arenas
+template <class T>
+struct Span {
+	T*	first;
+	T*	last;
+	T*	begin() const { return first; }
+	T*	end() const { return last; }
+	int	size() const { return last - first; }
+	T&	operator[](int i) const { return first[i]; }
+	operator Span<const T>() const { return { first, last }; }
 };
 
 
 struct Location {
 	glm::vec3	pos;
 	int			sector_nr;
+	int			cell_nr = 0;	// hint, corrected by the queries
 };
 
 
@@ -48,6 +75,19 @@ struct WallRef {
 struct Wall {
 	glm::vec2 pos;
 	std::vector<WallRef> refs;
+	int cell_nr = -1;	// the sector cell this wall borders
+};
+
+
+// convex piece of a sector
+// edge i runs from edges[i].vert_nr to edges[i + 1].vert_nr, cells are wound like triangulate() output
+struct SectorCell {
+	struct Edge {
+		int	vert_nr;	// index into the sector's walls
+		int	wall_nr;	// -1 for pseudo-portals
+		int	cell_nr;	// neighbour cell behind a pseudo-portal, otherwise -1
+	};
+	std::vector<Edge>	edges;
 };
 
 
@@ -55,7 +95,12 @@ struct Sector {
 	std::vector<Wall>		walls;
 	float					floor_height;
 	float					ceil_height;
-	std::vector<MapFace>	faces;
+	int						first_face = 0;
+	int						face_count = 0;
+	std::vector<SectorCell>	cells;
+	glm::vec2				min;	// bounding box
+	glm::vec2				max;
+	size_t					face_key = 0;	// faces are rebuilt when this changes
 };
 
 
@@ -64,13 +109,48 @@ public:
 	Map();
 	int		pick_sector(const glm::vec2& p) const;
 	void	clip_move(Location& loc, const glm::vec3& mov) const;
+	// rebuilds the faces of changed sectors only
 	void	setup_portals();
+	// setup_portals for a few modified sectors: only their walls and those of their neighbours
+	// are relinked, only they can get new faces. sectors must not have been inserted or erased
+	// since the last setup_portals
+	void	relink_sectors(const std::vector<int>& sector_nrs);
+	// move a few shadow maps off the emptiest atlas surface
+	void	defragment_shadow_atlas(int max_moves);
+	// breadth-first portal order starting at sector_nr, unreachable sectors last
+	void	get_sector_order(int sector_nr, std::vector<int>& order) const;
+	// name is given without extension, a precompiled name.pmap is preferred over name.txt
+	// unless it is older. the shadow maps come from the cache or get baked
+	void	init(const char* name);
 	bool	load(const char* name);
 	bool	save(const char* name) const;
+	bool	load_pmap(const char* name);
+	// with chunk_size > 0 sectors are grouped into square chunks of that size,
+	// each chunk's faces, vertices and shadow texels are stored contiguously for streaming
+	bool	save_pmap(const char* name, float chunk_size=0) const;
+	// sectors, portals and cells of a mapped pmap file, faces only if resident.
+	// the shadow atlas layout is restored either way
+	bool	load_pmap_data(const uint8_t* file, size_t size, bool resident);
+	// load the shadow maps from the cache, bake and cache them if there are none
+	void	init_shadows();
 	float	ray_intersect(	const Location& loc, const glm::vec3& dir,
 							WallRef& ref, glm::vec3& normal,
 							float max_factor=std::numeric_limits<float>::infinity()) const;
 
+	Span<MapFace>			get_faces(const Sector& s) {
+		return { faces.data() + s.first_face, faces.data() + s.first_face + s.face_count };
+	}
+	Span<const MapFace>		get_faces(const Sector& s) const {
+		return { faces.data() + s.first_face, faces.data() + s.first_face + s.face_count };
+	}
+	Span<MapVertex>			get_verts(const MapFace& f) {
+		return { verts.data() + f.first_vert, verts.data() + f.first_vert + f.vert_count };
+	}
+	Span<const MapVertex>	get_verts(const MapFace& f) const {
+		return { verts.data() + f.first_vert, verts.data() + f.first_vert + f.vert_count };
+	}
+	FaceTransform			face_transform(const MapFace& f) const;
+
 //private:
 
 	std::vector<Sector>	sectors = {
@@ -84,12 +164,66 @@ public:
 		},
 	};
 
+	// faces grouped by sector, vertices grouped by face.
+	// rebuilt sectors are appended, the ranges they leave behind are reclaimed by compact_faces
+	std::vector<MapFace>	faces;
+	std::vector<MapVertex>	verts;
+	// indexed like faces, only filled while baking
+	std::vector<FaceTransform>	face_transforms;
+
 	void	setup_sector_faces(Sector& s);
-	void	bake();
+	// appends to the given arrays, first_face and first_vert index into them.
+	// touches nothing but s, so sectors can be built in parallel
+	void	setup_sector_faces(Sector& s, std::vector<MapFace>& out_faces, std::vector<MapVertex>& out_verts);
+	// append the faces of the given sectors in parallel, in the same layout as one after the other
+	void	setup_faces(const std::vector<int>& sector_nrs);
+	void	compact_faces();
+	// dominant axis, texel density and origin of a face's shadow map
+	int		shadow_projection(const MapFace& f, Span<const MapVertex> vs,
+							  float& detail, glm::vec3& min, glm::ivec3& size) const;
+	// merge the floor triangles into convex cells connected by pseudo-portals
+	void	setup_sector_cells(Sector& s, const std::vector<glm::ivec3>& triangles);
+	// cell containing p, -1 if p is outside of the sector
+	int		locate_cell(const Sector& s, const glm::vec2& p, int hint) const;
+	bool	cell_contains(const Sector& s, const SectorCell& cell, const glm::vec2& p) const;
+	// ray_intersect that also returns the cell the ray ends in
+	float	trace(	const Location& loc, const glm::vec3& dir,
+					WallRef& ref, glm::vec3& normal, float max_factor, int& cell_nr) const;
+	// place the shadow maps of all faces into the atlas in one go
+	void	pack_shadow_atlas();
+	void	set_face_region(MapFace& f, const AtlasRegion& r);
+	size_t	sector_face_key(const Sector& s) const;
+	// top to bottom
+	void	sort_refs(std::vector<WallRef>& refs) const;
 	Atlas	shadow_atlas;
+	// regions owned by faces as of the last setup_portals or relink_sectors
+	std::vector<AtlasRegion> shadow_regions;
+
+	// sectors by the grid cells their bounding boxes overlap, to find the neighbours of relinked
+	// sectors. built by the first relink_sectors after anything else changed the revision
+	std::unordered_map<unsigned long long, std::vector<int>>	sector_grid;
+	int		sector_grid_revision = -1;
+	void	build_sector_grid();
+	void	grid_insert(int sector_nr);
+	void	grid_remove(int sector_nr);
+	// call f for the sector list of every existing cell overlapping the box
+	template <class Func>
+	void	for_sector_cells(const glm::vec2& min, const glm::vec2& max, Func f);
+	void	bake();
 
 	// try to adjust sector nr of location
 	bool	fix_sector(Location& loc) const;
+
+	// bumped whenever sectors or walls may have changed: by setup_portals, relink_sectors and pmap loads
+	int		revision = 0;
+
+	// what setup_portals and relink_sectors did, summed up until whoever reads it resets it. for benchmarks.
+	struct SetupStats {
+		int		calls;
+		int		rebuilt_sectors;
+		double	link_ms;	// wall cleanup and portal linking
+		double	faces_ms;	// face rebuild and atlas placement
+	} setup_stats = {};
 };
 
 
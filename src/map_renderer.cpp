@@ -0,0 +1,286 @@
+#include "map_renderer.h"
+#include "eye.h"
+
+#include <numeric>
+#include <glm/gtc/matrix_transform.hpp>
+
+
+// shadow maps moved per frame while defragmenting
+#define DEFRAGMENT_MOVES 8
+
+
+void MapRenderer::init() {
+
+    // NOTE: gl_Position is declared invariant in all map shaders
+    // so that the main pass can use DepthTestFunc::Equal after the depth pre-pass
+    shader = rmw::context.create_shader(
+        R"(#version 300 es
+            layout(location = 0) in vec3 in_pos;
+            layout(location = 1) in vec2 in_uv;
+            layout(location = 2) in vec3 in_uv2;
+            uniform mat4 mvp;
+            out vec2 ex_uv;
+            out vec3 ex_uv2;
+            out float ex_depth;
+            invariant gl_Position;
+            void main() {
+                gl_Position = mvp * vec4(in_pos, 1.0);
+                ex_uv = in_uv;
+                ex_uv2 = in_uv2;
+                ex_depth = gl_Position.z;
+            })",
+        R"(#version 300 es
+            precision mediump float;
+            precision mediump sampler2DArray;
+            in vec2 ex_uv;
+            in vec3 ex_uv2;
+            in float ex_depth;
+            uniform sampler2D tex;
+            uniform sampler2DArray shadow;
+            out vec4 out_color;
+            void main() {
+                vec4 c = texture(tex, ex_uv);
+                c.rgb *= texture(shadow, ex_uv2).r;
+                out_color = vec4(c.rgb * pow(0.99, ex_depth), c.a);
+            })");
+
+    depth_shader = rmw::context.create_shader(
+        R"(#version 300 es
+            layout(location = 0) in vec3 in_pos;
+            uniform mat4 mvp;
+            invariant gl_Position;
+            void main() {
+                gl_Position = mvp * vec4(in_pos, 1.0);
+            })",
+        R"(#version 300 es
+            precision mediump float;
+            out vec4 out_color;
+            void main() {
+                out_color = vec4(1.0);
+            })");
+
+    // every shaded fragment adds one to the red channel
+    overdraw_shader = rmw::context.create_shader(
+        R"(#version 300 es
+            layout(location = 0) in vec3 in_pos;
+            uniform mat4 mvp;
+            invariant gl_Position;
+            void main() {
+                gl_Position = mvp * vec4(in_pos, 1.0);
+            })",
+        R"(#version 300 es
+            precision mediump float;
+            out vec4 out_color;
+            void main() {
+                out_color = vec4(1.0 / 255.0, 0.0, 0.0, 0.0);
+            })");
+
+    vertex_buffer = rmw::context.create_vertex_buffer(rmw::BufferHint::StreamDraw);
+    vertex_array = rmw::context.create_vertex_array();
+    vertex_array->set_primitive_type(rmw::PrimitiveType::Triangles);
+    vertex_array->set_attribute(0, vertex_buffer, rmw::ComponentType::Float, 3, false, 0, sizeof(MapVertex));
+    vertex_array->set_attribute(1, vertex_buffer, rmw::ComponentType::Float, 2, false, 12, sizeof(MapVertex));
+    vertex_array->set_attribute(2, vertex_buffer, rmw::ComponentType::Float, 3, false, 20, sizeof(MapVertex));
+
+    // gray until the texture loader is done with them
+    const char* names[] = { "media/wall", "media/floor", "media/ceil" };
+    uint8_t placeholder[] = { 128, 128, 128, 255 };
+    texture_loader.init();
+    for (int i = 0; i < (int) textures.size(); ++i) {
+        textures[i] = rmw::context.create_texture_2D(rmw::TextureFormat::RGBA, 1, 1, placeholder);
+        texture_loader.load(*textures[i], names[i]);
+    }
+    upload_shadow_map();
+}
+
+
+void MapRenderer::upload_shadow_map() {
+    Atlas& atlas = map.shadow_atlas;
+    // all surfaces go into one array texture so faces from different surfaces share a draw call
+    shadow_map = rmw::context.create_texture_2D_array(
+            atlas.get_format() == Atlas::Format::R16 ? rmw::TextureFormat::R16 : rmw::TextureFormat::R8,
+            atlas.get_surface_size(), atlas.get_surface_size(),
+            std::max(1, atlas.get_surface_count()), rmw::FilterMode::Linear);
+    shadow_map->set_streaming(true);
+    for (int i = 0; i < atlas.get_surface_count(); ++i) {
+        shadow_map->set_layer(i, atlas.get_surface_data(i));
+    }
+    atlas.clear_dirty();
+}
+
+
+void MapRenderer::update_shadow_map() {
+    Atlas& atlas = map.shadow_atlas;
+    // the atlas spilled onto new surfaces
+    if (shadow_map->get_layers() < atlas.get_surface_count()) {
+        upload_shadow_map();
+        return;
+    }
+    // only upload what changed
+    for (int i = 0; i < atlas.get_surface_count(); ++i) {
+        const Atlas::Rect& r = atlas.get_dirty_rect(i);
+        if (r.w > 0) shadow_map->update(i, r.x, r.y, r.w, r.h, atlas.get_surface_data(i));
+    }
+    atlas.clear_dirty();
+}
+
+
+void MapRenderer::keyboard(const SDL_KeyboardEvent& key) {
+    if (key.type != SDL_KEYDOWN) return;
+    switch (key.keysym.scancode) {
+    case SDL_SCANCODE_F1:
+        sort_front_to_back = !sort_front_to_back;
+        printf("front-to-back sorting %s\n", sort_front_to_back ? "on" : "off");
+        break;
+    case SDL_SCANCODE_F2:
+        depth_prepass = !depth_prepass;
+        printf("depth pre-pass %s\n", depth_prepass ? "on" : "off");
+        break;
+    case SDL_SCANCODE_F3:
+        show_overdraw = !show_overdraw;
+        frame_counter = 0;
+        break;
+    case SDL_SCANCODE_F4:
+        defragment_atlas = !defragment_atlas;
+        printf("shadow atlas defragmentation %s\n", defragment_atlas ? "on" : "off");
+        break;
+    default: break;
+    }
+}
+
+
+void MapRenderer::draw(const rmw::RenderState& rs, const rmw::Framebuffer::Ptr& fb, const Frame& frame) {
+
+    texture_loader.poll();
+    if (defragment_atlas) map.defragment_shadow_atlas(DEFRAGMENT_MOVES);
+
+    // an edit since the frame was simulated may have renumbered the sectors
+    const std::vector<int>* order = &frame.sector_order;
+    if (!sort_front_to_back || frame.map_revision != map.revision) {
+        sector_order.resize(map.sectors.size());
+        std::iota(sector_order.begin(), sector_order.end(), 0);
+        order = &sector_order;
+    }
+
+    mesh.clear();
+    for (int i = 0; i < (int) ranges.size(); ++i) {
+        ranges[i].first = mesh.size();
+        for (int nr : *order) {
+            for (const MapFace& f : map.get_faces(map.sectors[nr])) {
+                if (f.tex_nr != i) continue;
+                Span<MapVertex> vs = map.get_verts(f);
+                mesh.insert(mesh.end(), vs.begin(), vs.end());
+            }
+        }
+        ranges[i].count = mesh.size() - ranges[i].first;
+    }
+    vertex_buffer->init_data(mesh);
+
+    update_shadow_map();
+
+
+    glm::mat4 mat_perspective = glm::perspective(
+        glm::radians(60.0f),
+        rmw::context.get_aspect_ratio(),
+        0.1f, 500.0f);
+
+    glm::mat4 mat_view = frame.view_mtx;
+    glm::mat4 mvp = mat_perspective * mat_view;
+
+
+    rmw::RenderState main_rs = rs;
+    if (depth_prepass) {
+        rmw::RenderState prepass_rs = rs;
+        prepass_rs.color_write_enabled = false;
+        depth_shader->set_uniform("mvp", mvp);
+        vertex_array->set_first(0);
+        vertex_array->set_count(mesh.size());
+        rmw::context.draw(prepass_rs, depth_shader, vertex_array, fb);
+
+        // only the visible fragment of each pixel survives the main pass
+        main_rs.depth_test_func = rmw::DepthTestFunc::Equal;
+        main_rs.depth_write_enabled = false;
+    }
+
+
+    if (show_overdraw) {
+        main_rs.blend_enabled = true;
+        main_rs.blend_func_src_rgb   = rmw::BlendFunc::One;
+        main_rs.blend_func_src_alpha = rmw::BlendFunc::One;
+        main_rs.blend_func_dst_rgb   = rmw::BlendFunc::One;
+        main_rs.blend_func_dst_alpha = rmw::BlendFunc::One;
+        overdraw_shader->set_uniform("mvp", mvp);
+        vertex_array->set_first(0);
+        vertex_array->set_count(mesh.size());
+        rmw::context.draw(main_rs, overdraw_shader, vertex_array, fb);
+        if (frame_counter++ % 60 == 0) print_overdraw(fb);
+        return;
+    }
+
+
+    shader->set_uniform("mvp", mvp);
+    shader->set_uniform("shadow", shadow_map);
+    for (int i = 0; i < (int) ranges.size(); ++i) {
+        vertex_array->set_first(ranges[i].first);
+        vertex_array->set_count(ranges[i].count);
+        shader->set_uniform("tex", textures[i]);
+        rmw::context.draw(main_rs, shader, vertex_array, fb);
+    }
+
+
+//        if (0)
+//        {
+//            renderer3D.set_transformation(mat_perspective * mat_view);
+//            renderer3D.set_line_width(3);
+//            renderer3D.set_point_size(5);
+//
+//            static glm::vec3 orig;
+//            static glm::vec3 dir;
+//            static glm::vec3 mark;
+//            static glm::vec3 mark_normal;
+//
+//            int x, y;
+//            int b = SDL_GetMouseState(&x, &y);
+//            if (b) {
+//                orig = eye.get_location().pos;
+//                glm::vec4 c = glm::vec4(x / (float) rmw::context.get_width() * 2 - 1,
+//                                        y / (float) rmw::context.get_height() * -2 + 1, -1, 1);
+//                glm::vec4 v = glm::inverse(mat_perspective * mat_view) * c;
+//                dir = glm::normalize(glm::vec3(v) / v.w - orig);
+//
+//                WallRef ref;
+//                float f = map.ray_intersect(eye.get_location(), dir, ref, mark_normal);
+//                mark = eye.get_location().pos + dir * f;
+//
+//                if (ref.wall_nr == -2) {
+//                    auto fs = map.get_faces(map.sectors[ref.sector_nr]);
+//                    auto& f = fs[fs.size() - 2];
+//                    auto t = glm::ivec2(glm::floor(glm::vec2(map.face_transform(f).inv_mat * glm::vec4(mark, 1)) + glm::vec2(0.5)));
+//                    map.shadow_atlas.set_texel(f.shadow, t.x, t.y, 0);
+//                }
+//            }
+//
+//            renderer3D.set_color(0, 255, 0);
+//            renderer3D.point(mark);
+//            renderer3D.set_color(0, 100, 0);
+//            renderer3D.line(mark, mark + mark_normal * 3.0f);
+//            renderer3D.flush();
+//        }
+}
+
+
+void MapRenderer::print_overdraw(const rmw::Framebuffer::Ptr& fb) {
+    rmw::context.read_pixels(fb, pixels);
+    long long fragments = 0;
+    int covered = 0;
+    int max = 0;
+    for (const glm::u8vec4& p : pixels) {
+        fragments += p.r;
+        covered += p.r > 0;
+        max = std::max<int>(max, p.r);
+    }
+    printf("overdraw: %.2f fragments per covered pixel, max %d (sorting %s, pre-pass %s)\n",
+           covered ? fragments / (float) covered : 0.0f, max,
+           sort_front_to_back ? "on" : "off",
+           depth_prepass ? "on" : "off");
+}
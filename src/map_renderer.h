@@ -0,0 +1,54 @@
+#pragma once
+
+#include "rmw.h"
+#include "map.h"
+#include "texture_loader.h"
+#include "simulation.h"
+
+#include <SDL2/SDL.h>
+
+
+class MapRenderer {
+public:
+    void init();
+    void keyboard(const SDL_KeyboardEvent& key);
+    void draw(const rmw::RenderState& rs, const rmw::Framebuffer::Ptr& fb, const Frame& frame);
+
+private:
+    typedef std::vector<MapVertex> Mesh;
+
+    struct Range {
+        int first;
+        int count;
+    };
+
+    void upload_shadow_map();
+    void update_shadow_map();
+    void print_overdraw(const rmw::Framebuffer::Ptr& fb);
+
+
+    rmw::Shader::Ptr                   shader;
+    rmw::Shader::Ptr                   depth_shader;
+    rmw::Shader::Ptr                   overdraw_shader;
+    rmw::VertexBuffer::Ptr             vertex_buffer;
+    rmw::VertexArray::Ptr              vertex_array;
+
+    // all faces of a frame, grouped by texture and ordered front to back within each group
+    Mesh                               mesh;
+    std::array<Range, 3>               ranges;
+    std::vector<int>                   sector_order;
+
+    TextureLoader                      texture_loader;
+    std::array<rmw::Texture2D::Ptr, 3> textures;
+    rmw::Texture2DArray::Ptr           shadow_map;
+
+    bool                               sort_front_to_back = true;
+    bool                               depth_prepass      = false;
+    bool                               show_overdraw      = false;
+    bool                               defragment_atlas   = false;
+    int                                frame_counter      = 0;
+    std::vector<glm::u8vec4>           pixels;
+};
+
+
+extern MapRenderer renderer;
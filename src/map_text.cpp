@@ -0,0 +1,157 @@
+#include "map_text.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+
+namespace {
+
+// buffered reader that keeps track of line and column
+class Reader {
+public:
+    enum { BUFFER_SIZE = 1 << 16 };
+
+    Reader(FILE* f) : m_file(f), m_buffer(BUFFER_SIZE) {}
+
+    int line() const { return m_line; }
+    int column() const { return m_column; }
+
+    // next character, -1 at the end of the file
+    int peek() {
+        if (m_pos == m_end && !fill(1)) return -1;
+        return (unsigned char) m_buffer[m_pos];
+    }
+
+    void advance() {
+        if (m_buffer[m_pos++] == '\n') {
+            ++m_line;
+            m_column = 1;
+        }
+        else ++m_column;
+    }
+
+    // nullptr on success, otherwise what is wrong with the number.
+    // the whole token is buffered first, so it never gets cut off at the end of the buffer
+    const char* number(float& v) {
+        size_t n = 0;
+        for (;;) {
+            if (m_pos + n == m_end) {
+                if (n == m_buffer.size()) return "number too long";
+                if (!fill(n + 1)) break;
+            }
+            char c = m_buffer[m_pos + n];
+            if (!(c >= '0' && c <= '9') && c != '+' && c != '-' && c != '.' && c != 'e' && c != 'E') break;
+            ++n;
+        }
+        const char* first = m_buffer.data() + m_pos;
+        std::from_chars_result r = std::from_chars(first, first + n, v);
+        if (r.ec != std::errc() || !std::isfinite(v)) return "expected a number";
+        m_column += r.ptr - first;
+        m_pos    += r.ptr - first;
+        return nullptr;
+    }
+
+private:
+    // make sure that n characters are buffered, false if the file ends before
+    bool fill(size_t n) {
+        if (m_end - m_pos >= n) return true;
+        memmove(m_buffer.data(), m_buffer.data() + m_pos, m_end - m_pos);
+        m_end -= m_pos;
+        m_pos = 0;
+        while (m_end < n && !m_eof) {
+            size_t r = fread(m_buffer.data() + m_end, 1, m_buffer.size() - m_end, m_file);
+            if (r == 0) m_eof = true;
+            m_end += r;
+        }
+        return m_end >= n;
+    }
+
+    FILE*             m_file;
+    std::vector<char> m_buffer;
+    size_t            m_pos    = 0;
+    size_t            m_end    = 0;
+    bool              m_eof    = false;
+    int               m_line   = 1;
+    int               m_column = 1;
+};
+
+} // namespace
+
+
+bool read_map_text(FILE* f, std::vector<Sector>& sectors, MapTextError& error) {
+    Reader r(f);
+    auto fail = [&r, &error](const char* message) {
+        error = { r.line(), r.column(), message };
+        return false;
+    };
+    auto skip_blanks = [&r]() {
+        for (int c = r.peek(); c == ' ' || c == '\t' || c == '\r'; c = r.peek()) r.advance();
+    };
+    auto pair = [&r, &fail](glm::vec2& v) {
+        if (const char* message = r.number(v.x)) return fail(message);
+        if (r.peek() != ',') return fail("expected ','");
+        r.advance();
+        if (const char* message = r.number(v.y)) return fail(message);
+        return true;
+    };
+
+    for (;;) {
+        // empty lines between sectors are fine
+        skip_blanks();
+        int c = r.peek();
+        if (c == -1) break;
+        if (c == '\n') {
+            r.advance();
+            continue;
+        }
+
+        sectors.emplace_back();
+        Sector& s = sectors.back();
+        glm::vec2 p;
+        do {
+            if (!pair(p)) return false;
+            s.walls.push_back({ p });
+            skip_blanks();
+            c = r.peek();
+        } while (c != '\n' && c != -1);
+        if (c == '\n') r.advance();
+
+        skip_blanks();
+        if (r.peek() == -1) return fail("missing floor and ceiling height");
+        if (!pair(p)) return false;
+        s.floor_height = p.x;
+        s.ceil_height  = p.y;
+        skip_blanks();
+        c = r.peek();
+        if (c != '\n' && c != -1) return fail("expected end of line");
+    }
+    return true;
+}
+
+
+bool write_map_text(FILE* f, const std::vector<Sector>& sectors) {
+    std::string out;
+    char buf[64];
+    auto pair = [&out, &buf](float x, float y) {
+        char* p = buf;
+        *p++ = ' ';
+        p = std::to_chars(p, buf + sizeof(buf), x).ptr;
+        *p++ = ',';
+        p = std::to_chars(p, buf + sizeof(buf), y).ptr;
+        out.append(buf, p);
+    };
+    for (const Sector& s : sectors) {
+        for (const Wall& w : s.walls) pair(w.pos.x, w.pos.y);
+        out += '\n';
+        pair(s.floor_height, s.ceil_height);
+        out += '\n';
+        if (out.size() >= Reader::BUFFER_SIZE) {
+            fwrite(out.data(), 1, out.size(), f);
+            out.clear();
+        }
+    }
+    fwrite(out.data(), 1, out.size(), f);
+    return !ferror(f);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "map.h"
+
+#include <cstdio>
+
+
+// the text map format: per sector a line of x,y wall positions followed by a line with floor,ceil.
+// lines may be of any length, floats are written in their shortest form that reads back exactly.
+
+struct MapTextError {
+    int         line;
+    int         column;
+    const char* message;
+};
+
+// sectors are appended, on failure error points at the offending character
+bool read_map_text(FILE* f, std::vector<Sector>& sectors, MapTextError& error);
+bool write_map_text(FILE* f, const std::vector<Sector>& sectors);
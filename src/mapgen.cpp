@@ -0,0 +1,161 @@
+#include "mapgen.h"
+
+#include <cmath>
+#include <algorithm>
+
+
+namespace {
+
+// splitmix64, maps must not depend on the standard library's generators and distributions
+struct Rng {
+    uint64_t state;
+
+    Rng(uint64_t seed, uint64_t a, uint64_t b, uint64_t c)
+        : state(seed ^ a * 0x9e3779b97f4a7c15 ^ b * 0xc2b2ae3d27d4eb4f ^ c * 0x165667b19e3779f9) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+    // [0, 1)
+    float uniform() { return (next() >> 40) / float(1 << 24); }
+    float uniform(float a, float b) { return a + (b - a) * uniform(); }
+};
+
+enum { VERTICAL, HORIZONTAL, HEIGHT, STACKED };
+
+// eighths keep the text short and the shared points exact
+float quantize(float v) { return std::round(v * 8) / 8; }
+
+// the line between two grid cells, a is the cell left of or below it
+struct Boundary {
+    enum Type { Closed, Door, Open } type;
+    float t0, t1;   // door posts along the line
+    float dent;     // closed lines are dented into one of the cells
+    float post;     // depth of the door posts in cell b
+};
+
+
+class Generator {
+public:
+    Generator(const MapGenParams& p, std::vector<Sector>& sectors) : p(p), sectors(sectors) {}
+
+    void run() {
+        if (p.sectors <= 0) return;
+        // at most one room on top of each other one
+        stacked_share = std::min(std::max(p.stacked, 0.0f), 1.0f);
+        rooms = std::min(p.sectors, std::max(1, (int) std::ceil(p.sectors / (1 + stacked_share))));
+        cols  = std::ceil(std::sqrt((float) rooms));
+
+        // rooms that get another one on top, picked by chance and topped up in order
+        int uppers = p.sectors - rooms;
+        std::vector<bool> stacked(rooms);
+        for (int i = 0; i < rooms && uppers > 0; ++i) {
+            if (Rng(p.seed, i, 0, STACKED).uniform() >= stacked_share) continue;
+            stacked[i] = true;
+            --uppers;
+        }
+        for (int i = 0; i < rooms && uppers > 0; ++i) {
+            if (stacked[i]) continue;
+            stacked[i] = true;
+            --uppers;
+        }
+
+        sectors.reserve(sectors.size() + p.sectors);
+        for (int i = 0; i < rooms; ++i) {
+            int cx = i % cols;
+            int cy = i / cols;
+            Rng rng(p.seed, cx, cy, HEIGHT);
+            Sector s;
+            add_walls(s, cx, cy);
+            s.floor_height = quantize(rng.uniform(-p.height_variation, p.height_variation));
+            s.ceil_height  = quantize(s.floor_height + p.room_height * rng.uniform(0.75f, 1.25f));
+            if (stacked[i]) {
+                Sector upper = s;
+                upper.floor_height = s.ceil_height + 1;
+                upper.ceil_height  = quantize(upper.floor_height + p.room_height * rng.uniform(0.75f, 1.25f));
+                sectors.push_back(std::move(s));
+                sectors.push_back(std::move(upper));
+            }
+            else sectors.push_back(std::move(s));
+        }
+    }
+
+private:
+    bool exists(int cx, int cy) const {
+        return cx >= 0 && cy >= 0 && cx < cols && cy * cols + cx < rooms;
+    }
+
+    // line at x = bx between rows, or at y = by between columns
+    Boundary boundary(int bx, int by, int dir, bool both) const {
+        Rng rng(p.seed, bx, by, dir);
+        Boundary b;
+        b.type = Boundary::Closed;
+        if (rng.uniform() < p.portals && both) {
+            b.type = rng.uniform() < p.doors ? Boundary::Door : Boundary::Open;
+        }
+        b.t0   = rng.uniform(0.15f, 0.4f);
+        b.t1   = rng.uniform(0.6f, 0.85f);
+        b.dent = rng.uniform() < p.concavity ? rng.uniform(0.1f, 0.4f) * p.room_size : 0;
+        b.post = rng.uniform(0.05f, 0.1f) * p.room_size;
+        return b;
+    }
+
+    // one side of a room. start and end are the line's ends in ascending order, normal points into
+    // cell a. shared points are computed from the line alone so both rooms agree on them exactly
+    void add_side(Sector& s, glm::vec2 start, glm::vec2 end, glm::vec2 normal,
+                  const Boundary& b, bool forward, bool is_a, bool a_exists) const {
+        glm::vec2 ps[4];
+        int n = 0;
+        if (b.type == Boundary::Door) {
+            // cell b gets posts as deep as b.post on both sides of the door, so only the door
+            // itself is shared and the line next to it is a wall in both cells
+            glm::vec2 d0 = glm::mix(start, end, b.t0);
+            glm::vec2 d1 = glm::mix(start, end, b.t1);
+            if (!is_a) ps[n++] = d0 - normal * b.post;
+            ps[n++] = d0;
+            ps[n++] = d1;
+            if (!is_a) ps[n++] = d1 - normal * b.post;
+        }
+        else if (b.type == Boundary::Closed && is_a == a_exists) {
+            // only one room splits the line, so there is no portal
+            ps[n++] = glm::mix(start, end, 0.5f) + (is_a ? normal : -normal) * b.dent;
+        }
+        if (!forward) std::reverse(ps, ps + n);
+        s.walls.push_back({ forward ? start : end });
+        for (int i = 0; i < n; ++i) s.walls.push_back({ glm::vec2(quantize(ps[i].x), quantize(ps[i].y)) });
+    }
+
+    // clockwise: left side up, top side right, right side down, bottom side left
+    void add_walls(Sector& s, int cx, int cy) const {
+        float size = p.room_size;
+        glm::vec2 p00(cx * size, cy * size);
+        glm::vec2 p11((cx + 1) * size, (cy + 1) * size);
+        glm::vec2 p01(p00.x, p11.y);
+        glm::vec2 p10(p11.x, p00.y);
+        bool left   = exists(cx - 1, cy);
+        bool right  = exists(cx + 1, cy);
+        bool bottom = exists(cx, cy - 1);
+        bool top    = exists(cx, cy + 1);
+        add_side(s, p00, p01, { -1, 0 }, boundary(cx, cy, VERTICAL, left), true, false, left);
+        add_side(s, p01, p11, { 0, -1 }, boundary(cx, cy + 1, HORIZONTAL, top), true, true, true);
+        add_side(s, p10, p11, { -1, 0 }, boundary(cx + 1, cy, VERTICAL, right), false, true, true);
+        add_side(s, p00, p10, { 0, -1 }, boundary(cx, cy, HORIZONTAL, bottom), false, false, bottom);
+    }
+
+
+    const MapGenParams&  p;
+    std::vector<Sector>& sectors;
+    float                stacked_share;
+    int                  rooms;
+    int                  cols;
+};
+
+} // namespace
+
+
+void generate_map(const MapGenParams& params, std::vector<Sector>& sectors) {
+    Generator(params, sectors).run();
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "map.h"
+
+#include <cstdint>
+
+
+// rooms on a square grid. neighbouring rooms share an open edge, a door between two posts or nothing,
+// rooms stacked over rooms connect to whatever neighbours their heights overlap.
+// the same parameters always produce the same map.
+struct MapGenParams {
+    uint64_t seed             = 1;
+    int      sectors          = 1000;
+    float    room_size        = 16;     // edge length of the grid cells
+    float    room_height      = 10;
+    float    height_variation = 3;      // floors vary by up to this much either way
+    float    portals          = 0.7f;   // chance that neighbouring rooms are connected
+    float    doors            = 0.5f;   // share of the connections that are doors rather than open edges
+    float    concavity        = 0.5f;   // chance that a closed wall is dented into the room
+    float    stacked          = 0.1f;   // share of rooms that are stacked over other rooms, clamped to [0, 1]
+};
+
+// exactly params.sectors sectors are appended, walls run clockwise like in media/map.txt
+void generate_map(const MapGenParams& params, std::vector<Sector>& sectors);
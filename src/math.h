@@ -1,5 +1,7 @@
 #pragma once
 #include <algorithm>
+#include <vector>
+#include <cmath>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/norm.hpp>
 
@@ -40,65 +42,136 @@ inline bool is_oriented_cw(const glm::vec2& a, const glm::vec2& b, const glm::ve
 	return cross(ac, ab) >= 0;
 }
 
-inline bool any_point_in_triangle(
-		const std::vector<const glm::vec2*>& vertices,
-		const glm::vec2& a, const glm::vec2& b, const glm::vec2& c) {
-	for (const glm::vec2* p : vertices) {
-		if ((p != &a) && (p != &b) && (p != &c) && point_in_triangle(*p, a, b, c)) return true;
-	}
-	return false;
-}
-
-inline bool is_ear(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c, const std::vector<const glm::vec2*>& vertices) {
-	return is_oriented_cw(a, b, c) && !any_point_in_triangle(vertices, a, b, c);
-}
-
+// ear clipper, polygons of either orientation are emitted with is_oriented_cw winding.
+// reflex vertices are kept in a uniform grid so that ear tests only look at nearby ones.
+// duplicate and collinear points are dropped first. if no ear is left (self-intersecting input)
+// a vertex is clipped anyway and false is returned.
 template <class Func>
 bool triangulate(const std::vector<glm::vec2>& poly, Func f) {
-	std::vector<int> prev_index(poly.size());
-	std::vector<int> next_index(poly.size());
-	for (int i = 0; i < (int) poly.size(); ++i) {
-		prev_index[i] = i - 1;
-		next_index[i] = i + 1;
+	int n = poly.size();
+	if (n < 3) return false;
+
+	float area = 0;
+	for (int i = 0; i < n; ++i) area += cross(poly[i], poly[(i + 1) % n]);
+	bool reverse = area > 0;
+
+	std::vector<int> prev_index(n);
+	std::vector<int> next_index(n);
+	for (int i = 0; i < n; ++i) {
+		prev_index[i] = reverse ? (i + 1) % n : (i + n - 1) % n;
+		next_index[i] = reverse ? (i + n - 1) % n : (i + 1) % n;
 	}
-	prev_index[0] = poly.size() - 1;
-	next_index[poly.size() - 1] = 0;
+	int left = n;
+	auto remove = [&](int i) {
+		next_index[prev_index[i]] = next_index[i];
+		prev_index[next_index[i]] = prev_index[i];
+		--left;
+	};
 
-	std::vector<const glm::vec2*> concave;
-	for (int i = 0; i < (int) poly.size(); ++i) {
-		if (!is_oriented_cw(poly[prev_index[i]], poly[i], poly[next_index[i]])) {
-			concave.push_back(&poly[i]);
+	// drop duplicate and collinear points
+	int current = 0;
+	for (int checked = 0; left > 3 && checked < left;) {
+		const glm::vec2& a = poly[prev_index[current]];
+		const glm::vec2& b = poly[current];
+		const glm::vec2& c = poly[next_index[current]];
+		if (a == b || cross(b - a, c - b) == 0) {
+			int prev = prev_index[current];
+			remove(current);
+			current = prev;
+			checked = 0;
+		}
+		else {
+			current = next_index[current];
+			++checked;
 		}
 	}
 
-	int left = poly.size();
+
+	// reflex vertex grid with about one cell per vertex
+	glm::vec2 lo = poly[0];
+	glm::vec2 hi = poly[0];
+	for (const glm::vec2& p : poly) {
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+	glm::vec2 extent = glm::max(hi - lo, glm::vec2(1e-6));
+	float side = std::sqrt(extent.x * extent.y / left);
+	glm::ivec2 grid_size = glm::clamp(glm::ivec2(extent / side) + glm::ivec2(1), glm::ivec2(1), glm::ivec2(left));
+	glm::vec2 cell_size = extent / glm::vec2(grid_size);
+	auto cell_of = [&](const glm::vec2& p) {
+		return glm::clamp(glm::ivec2((p - lo) / cell_size), glm::ivec2(0), grid_size - glm::ivec2(1));
+	};
+	std::vector<std::vector<int>> grid(grid_size.x * grid_size.y);
+	auto cell = [&](int i) -> std::vector<int>& {
+		glm::ivec2 c = cell_of(poly[i]);
+		return grid[c.y * grid_size.x + c.x];
+	};
+	std::vector<bool> reflex(n, false);
+	int reflex_count = 0;
+	auto is_convex = [&](int i) {
+		return is_oriented_cw(poly[prev_index[i]], poly[i], poly[next_index[i]]);
+	};
+	auto unmark_reflex = [&](int i) {
+		if (!reflex[i]) return;
+		reflex[i] = false;
+		--reflex_count;
+		std::vector<int>& c = cell(i);
+		*std::find(c.begin(), c.end(), i) = c.back();
+		c.pop_back();
+	};
+	for (int i = current, k = 0; k < left; i = next_index[i], ++k) {
+		if (is_convex(i)) continue;
+		reflex[i] = true;
+		++reflex_count;
+		cell(i).push_back(i);
+	}
+
+	auto is_ear = [&](int i) {
+		const glm::vec2& a = poly[prev_index[i]];
+		const glm::vec2& b = poly[i];
+		const glm::vec2& c = poly[next_index[i]];
+		if (!is_oriented_cw(a, b, c)) return false;
+		if (reflex_count == 0) return true;
+		glm::ivec2 c0 = cell_of(glm::min(a, glm::min(b, c)));
+		glm::ivec2 c1 = cell_of(glm::max(a, glm::max(b, c)));
+		for (int y = c0.y; y <= c1.y; ++y)
+		for (int x = c0.x; x <= c1.x; ++x) {
+			for (int j : grid[y * grid_size.x + x]) {
+				if (j == prev_index[i] || j == next_index[i]) continue;
+				const glm::vec2& p = poly[j];
+				if (p == a || p == b || p == c) continue;
+				if (point_in_triangle(p, a, b, c)) return false;
+			}
+		}
+		return true;
+	};
+
+
+	bool ok = true;
 	int skipped = 0;
-	int current = 1;
-	int next, prev;
 	while (left > 3) {
-		prev = prev_index[current];
-		next = next_index[current];
-		const glm::vec2& a = poly[prev];
-		const glm::vec2& b = poly[current];
-		const glm::vec2& c = poly[next];
-		if (is_ear(a, b, c, concave)) {
-			f(a, b, c);
-			next_index[prev] = next;
-			prev_index[next] = prev;
-			auto it = std::find(concave.begin(), concave.end(), &b);
-			if (it != concave.end()) concave.erase(it);
-			--left;
-			skipped = 0;
-		}
-		else if (++skipped > left) {
-			printf("WOOT\n");
-			return false;
+		if (!is_ear(current)) {
+			if (++skipped <= left) {
+				current = next_index[current];
+				continue;
+			}
+			// no ear found in a whole round, clip the next convex vertex
+			ok = false;
+			for (int k = 0; k < left && !is_convex(current); ++k) current = next_index[current];
 		}
-		current = next;
+		int prev = prev_index[current];
+		int next = next_index[current];
+		f(poly[prev], poly[current], poly[next]);
+		remove(current);
+		// clipping only ever makes the neighbours convex
+		unmark_reflex(current);
+		if (is_convex(prev)) unmark_reflex(prev);
+		if (is_convex(next)) unmark_reflex(next);
+		skipped = 0;
+		// skipping a vertex avoids fans of long thin triangles
+		current = next_index[next];
 	}
-	next = next_index[current];
-	prev = prev_index[current];
-	f(poly[prev], poly[current], poly[next]);
+	f(poly[prev_index[current]], poly[current], poly[next_index[current]]);
 
-	return true;
+	return ok;
 }
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+
+
+// precompiled map: sectors with their resolved portals and convex cells, face meshes and
+// shadow atlas regions as flat little-endian arrays that are copied straight out of the mapped file.
+// chunked files group faces, vertices and baked shadow texels by spatial chunk for streaming.
+namespace pmap {
+
+const char MAGIC[4] = { 'P', 'M', 'A', 'P' };
+
+// bump whenever one of the structs below changes
+enum { VERSION = 2 };
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "pmap files are little-endian"
+#endif
+
+// offset from the start of the file, 8 byte aligned, and element count
+struct Array {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct Header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t shadow_atlas_size; // regions are only valid for this surface size
+    uint32_t shadow_bytes_per_texel;
+    Array    sectors;
+    Array    walls;
+    Array    refs;
+    Array    cells;
+    Array    edges;
+    Array    faces;
+    Array    verts;
+    Array    chunks;            // empty unless the file is chunked
+    Array    texels;            // bytes, shadow texels of all faces in face order
+};
+static_assert(sizeof(Header) == 160, "unexpected pmap header layout");
+
+struct Sector {
+    float    floor_height;
+    float    ceil_height;
+    float    min[2];
+    float    max[2];
+    uint32_t first_wall;
+    uint32_t wall_count;
+    uint32_t first_cell;
+    uint32_t cell_count;
+    uint32_t first_face;
+    uint32_t face_count;
+    uint64_t face_key;
+    uint32_t chunk_nr;
+    uint32_t reserved;
+};
+static_assert(sizeof(Sector) == 64, "unexpected pmap sector layout");
+
+struct Wall {
+    float    pos[2];
+    int32_t  cell_nr;
+    uint32_t first_ref;
+    uint32_t ref_count;
+};
+
+struct WallRef {
+    int32_t  sector_nr;
+    int32_t  wall_nr;
+};
+
+struct Cell {
+    uint32_t first_edge;
+    uint32_t edge_count;
+};
+
+struct Edge {
+    int32_t  vert_nr;
+    int32_t  wall_nr;
+    int32_t  cell_nr;
+};
+
+// the shadow region is stored as placed in the atlas
+struct Face {
+    float    normal[3];
+    int32_t  tex_nr;
+    int32_t  surface_nr;
+    int32_t  x;
+    int32_t  y;
+    int32_t  w;
+    int32_t  h;
+    uint32_t rotated;
+    uint32_t first_vert;
+    uint32_t vert_count;
+};
+
+// the faces, vertices and texels of a chunk's sectors are contiguous
+struct Chunk {
+    float    min[2];
+    float    max[2];
+    uint32_t first_face;
+    uint32_t face_count;
+    uint32_t first_vert;
+    uint32_t vert_count;
+    uint64_t first_texel;
+    uint64_t texel_count;
+};
+static_assert(sizeof(Chunk) == 48, "unexpected pmap chunk layout");
+
+// same layout as MapVertex
+struct Vertex {
+    float    pos[3];
+    float    uv[2];
+    float    uv2[3];
+};
+
+} // namespace pmap
@@ -80,8 +80,26 @@ constexpr uint32_t map_to_gl(CullFace cf) {
     const uint32_t lut[] = { GL_FRONT, GL_BACK, GL_FRONT_AND_BACK };
     return lut[static_cast<int>(cf)];
 }
-constexpr uint32_t map_to_gl(TextureFormat tf) {
-    const uint32_t lut[] = { GL_RGB, GL_RGBA, GL_DEPTH_COMPONENT, GL_STENCIL_INDEX, GL_DEPTH_STENCIL };
+#ifndef GL_R16
+#define GL_R16 0x822A // EXT_texture_norm16
+#endif
+struct GlTextureFormat {
+    uint32_t internal_format;
+    uint32_t format;
+    uint32_t type;
+    int      unpack_alignment;
+};
+constexpr GlTextureFormat map_to_gl(TextureFormat tf) {
+    const GlTextureFormat lut[] = {
+        { GL_RGB,               GL_RGB,               GL_UNSIGNED_BYTE,  4 },
+        { GL_RGBA,              GL_RGBA,              GL_UNSIGNED_BYTE,  4 },
+        { GL_DEPTH_COMPONENT,   GL_DEPTH_COMPONENT,   GL_UNSIGNED_BYTE,  4 },
+        { GL_STENCIL_INDEX,     GL_STENCIL_INDEX,     GL_UNSIGNED_BYTE,  4 },
+        { GL_DEPTH_STENCIL,     GL_DEPTH_STENCIL,     GL_UNSIGNED_BYTE,  4 },
+        { GL_R8,                GL_RED,               GL_UNSIGNED_BYTE,  1 },
+        { GL_R16,               GL_RED,               GL_UNSIGNED_SHORT, 2 },
+        { GL_LUMINANCE,         GL_LUMINANCE,         GL_UNSIGNED_BYTE,  1 },
+    };
     return lut[static_cast<int>(tf)];
 }
 
@@ -150,6 +168,12 @@ void GpuBuffer::init_data(const void* data, int size) {
     bind();
     glBufferData(m_target, m_size, data, map_to_gl(m_hint));
 }
+void GpuBuffer::update_data(int offset, const void* data, int size) {
+    assert(offset >= 0 && offset + size <= m_size);
+    cache.bind_vertex_array(0);
+    bind();
+    glBufferSubData(m_target, offset, size, data);
+}
 
 VertexBuffer::VertexBuffer(BufferHint hint) : GpuBuffer(GL_ARRAY_BUFFER, hint) {}
 IndexBuffer::IndexBuffer(BufferHint hint) : GpuBuffer(GL_ELEMENT_ARRAY_BUFFER, hint) {}
@@ -174,7 +198,7 @@ static GLuint compile_shader(uint32_t type, const char* src) {
 }
 
 
-bool Shader::init(const char* vs, const char* fs) {
+static bool link_program(GLuint program, const char* vs, const char* fs) {
     GLint v = compile_shader(GL_VERTEX_SHADER, vs);
     if (v == 0) return false;
     GLint f = compile_shader(GL_FRAGMENT_SHADER, fs);
@@ -182,45 +206,149 @@ bool Shader::init(const char* vs, const char* fs) {
         glDeleteShader(v);
         return false;
     }
-    m_program = glCreateProgram();
-
-    glAttachShader(m_program, v);
-    glAttachShader(m_program, f);
+    glAttachShader(program, v);
+    glAttachShader(program, f);
+    glLinkProgram(program);
+    glDetachShader(program, v);
+    glDetachShader(program, f);
     glDeleteShader(v);
     glDeleteShader(f);
-    glLinkProgram(m_program);
+
+    GLint e = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &e);
+    if (e) return true;
+    int len = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
+    std::vector<char> log(len + 1);
+    glGetProgramInfoLog(program, len, &len, log.data());
+    fprintf(stderr, "Error: can't link shader\n%s\n", log.data());
+    return false;
+}
+
+
+// program binary cache
+// a binary is only valid for the driver that produced it, so the driver strings are part of the key
+#if !defined(__EMSCRIPTEN__) && !defined(NO_SHADER_CACHE)
+#define SHADER_CACHE "shader_%016llx.bin"
+
+static uint64_t fnv1a(uint64_t h, const char* s) {
+    do {
+        h ^= uint8_t(*s);
+        h *= 0x100000001b3ull;
+    } while (*s++);
+    return h;
+}
+
+static uint64_t program_key(const char* vs, const char* fs) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    h = fnv1a(h, vs);
+    h = fnv1a(h, fs);
+    for (GLenum e : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        const char* str = reinterpret_cast<const char*>(glGetString(e));
+        h = fnv1a(h, str ? str : "");
+    }
+    return h;
+}
+
+static bool program_binary_supported() {
+    // stays 0 where program binaries are not supported
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+    return count > 0;
+}
+
+static bool load_program_binary(GLuint program, const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) return false;
+    uint32_t format;
+    std::vector<char> data;
+    bool ok = fread(&format, sizeof(format), 1, f) == 1;
+    if (ok) {
+        long start = ftell(f);
+        fseek(f, 0, SEEK_END);
+        data.resize(ftell(f) - start);
+        fseek(f, start, SEEK_SET);
+        ok = !data.empty() && fread(data.data(), data.size(), 1, f) == 1;
+    }
+    fclose(f);
+    if (!ok) return false;
+
+    glProgramBinary(program, format, data.data(), data.size());
+    GLint e = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &e);
+    return e;
+}
+
+static void save_program_binary(GLuint program, const char* filename) {
+    GLint len = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &len);
+    if (len <= 0) return;
+    std::vector<char> data(len);
+    GLenum format;
+    glGetProgramBinary(program, len, &len, &format, data.data());
+    FILE* f = fopen(filename, "wb");
+    if (!f) return;
+    uint32_t fmt = format;
+    fwrite(&fmt, sizeof(fmt), 1, f);
+    fwrite(data.data(), len, 1, f);
+    fclose(f);
+}
+#endif
+
+
+bool Shader::init(const char* vs, const char* fs) {
+    m_program = glCreateProgram();
+
+#ifdef SHADER_CACHE
+    // fall back to compiling when the binary is missing or was rejected by the driver
+    char filename[64];
+    snprintf(filename, sizeof(filename), SHADER_CACHE, (unsigned long long) program_key(vs, fs));
+    bool use_cache = program_binary_supported();
+    if (!use_cache || !load_program_binary(m_program, filename)) {
+        if (use_cache) glProgramParameteri(m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        if (!link_program(m_program, vs, fs)) return false;
+        if (use_cache) save_program_binary(m_program, filename);
+    }
+#else
+    if (!link_program(m_program, vs, fs)) return false;
+#endif
 
 
     // attributes
     int count;
+    int max_length;
+    std::vector<char> name;
     glGetProgramiv(m_program, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(m_program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+    name.resize(max_length + 1);
     for (int i = 0; i < count; ++i) {
-        char name[128];
         int size;
         uint32_t type;
-        glGetActiveAttrib(m_program, i, sizeof(name), nullptr, &size, &type, name);
-        m_attributes.push_back({ name, type, glGetAttribLocation(m_program, name) });
+        glGetActiveAttrib(m_program, i, name.size(), nullptr, &size, &type, name.data());
+        m_attributes.push_back({ name.data(), type, glGetAttribLocation(m_program, name.data()) });
     }
 
     // uniforms
     glGetProgramiv(m_program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    name.resize(max_length + 1);
     for (int i = 0; i < count; ++i) {
-        char name[128];
         int size; // > 1 for arrays
         uint32_t type;
-        glGetActiveUniform(m_program, i, sizeof(name), nullptr, &size, &type, name);
-        int location = glGetUniformLocation(m_program, name);
+        glGetActiveUniform(m_program, i, name.size(), nullptr, &size, &type, name.data());
+        int location = glGetUniformLocation(m_program, name.data());
         Uniform::Ptr u;
         switch (type) {
-        case GL_FLOAT:        u = std::make_unique<UniformExtend<float>>(name, type, location); break;
-        case GL_FLOAT_VEC2: u = std::make_unique<UniformExtend<glm::vec2>>(name, type, location); break;
-        case GL_FLOAT_VEC3: u = std::make_unique<UniformExtend<glm::vec3>>(name, type, location); break;
-        case GL_FLOAT_VEC4: u = std::make_unique<UniformExtend<glm::vec4>>(name, type, location); break;
-        case GL_FLOAT_MAT4: u = std::make_unique<UniformExtend<glm::mat4>>(name, type, location); break;
-        case GL_SAMPLER_2D: u = std::make_unique<UniformTexture2D>(name, type, location); break;
+        case GL_FLOAT:        u = std::make_unique<UniformExtend<float>>(name.data(), type, location); break;
+        case GL_FLOAT_VEC2: u = std::make_unique<UniformExtend<glm::vec2>>(name.data(), type, location); break;
+        case GL_FLOAT_VEC3: u = std::make_unique<UniformExtend<glm::vec3>>(name.data(), type, location); break;
+        case GL_FLOAT_VEC4: u = std::make_unique<UniformExtend<glm::vec4>>(name.data(), type, location); break;
+        case GL_FLOAT_MAT4: u = std::make_unique<UniformExtend<glm::mat4>>(name.data(), type, location); break;
+        case GL_SAMPLER_2D: u = std::make_unique<UniformTexture2D>(name.data(), type, location); break;
+        case GL_SAMPLER_2D_ARRAY: u = std::make_unique<UniformTexture2DArray>(name.data(), type, location); break;
 
         default:
-            fprintf(stderr, "Error: uniform '%s' has unknown type\n", name);
+            fprintf(stderr, "Error: uniform '%s' has unknown type\n", name.data());
             assert(false);
         }
         m_uniforms.push_back(std::move(u));
@@ -253,15 +381,144 @@ void Shader::UniformTexture2D::update() const {
     cache.bind_texture(unit, GL_TEXTURE_2D, handle);
     glUniform1i(location, unit);
 }
+void Shader::UniformTexture2DArray::update() const {
+    int unit = location;
+    cache.bind_texture(unit, GL_TEXTURE_2D_ARRAY, handle);
+    glUniform1i(location, unit);
+}
 
 
 // texture
 
+static void set_filter(uint32_t target, FilterMode filter) {
+    if (filter == FilterMode::Nearest) {
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    else {
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (filter == FilterMode::Trilinear) {
+            glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        }
+        else {
+            glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        }
+    }
+}
+
+
+static int mip_level_count(int w, int h) {
+    int levels = 1;
+    while ((w | h) >> levels) ++levels;
+    return levels;
+}
+
+
+static int texel_size(const GlTextureFormat& f) {
+    int components = f.format == GL_RGBA ? 4 : f.format == GL_RGB ? 3 : 1;
+    return components * (f.type == GL_UNSIGNED_SHORT ? 2 : 1);
+}
+
+
+// upload w * h texels from src, whose rows are row_length texels apart
+static void upload_rect(uint32_t target, int level, int layer, const GlTextureFormat& f,
+                        int x, int y, int w, int h, const uint8_t* src, int row_length,
+                        uint32_t pixel_buffer) {
+    static std::vector<uint8_t> staging;
+
+    const void* data = src;
+    if (pixel_buffer) {
+        // glBufferData orphans the previous contents, so this never waits for an earlier upload
+        // and the copy into the texture is done by the driver asynchronously
+        int ts = texel_size(f);
+        if (row_length != w) {
+            staging.resize(w * h * ts);
+            for (int j = 0; j < h; ++j) {
+                memcpy(staging.data() + j * w * ts, src + j * row_length * ts, w * ts);
+            }
+            src = staging.data();
+            row_length = w;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, w * h * ts, src, GL_STREAM_DRAW);
+        data = nullptr;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, f.unpack_alignment);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length == w ? 0 : row_length);
+    if (target == GL_TEXTURE_2D) {
+        glTexSubImage2D(target, level, x, y, w, h, f.format, f.type, data);
+    }
+    else {
+        glTexSubImage3D(target, level, x, y, layer, w, h, 1, f.format, f.type, data);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    if (pixel_buffer) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+
+// upload the rect of level 0 and box filter the mipmap texels covering it straight from level 0
+static void update_rect(uint32_t target, int layer, TextureFormat format, FilterMode filter,
+                        int width, int height, int x, int y, int w, int h,
+                        const void* image, uint32_t pixel_buffer) {
+    assert(x >= 0 && y >= 0 && w > 0 && h > 0 && x + w <= width && y + h <= height);
+    GlTextureFormat f = map_to_gl(format);
+    int ts = texel_size(f);
+    const uint8_t* img = static_cast<const uint8_t*>(image);
+    upload_rect(target, 0, layer, f, x, y, w, h, img + (y * width + x) * ts, width, pixel_buffer);
+    if (filter != FilterMode::Trilinear) return;
+
+    bool wide = f.type == GL_UNSIGNED_SHORT;
+    int components = wide ? ts / 2 : ts;
+    std::vector<uint8_t> mip;
+    std::array<uint32_t, 4> sum;
+    for (int level = 1; level < mip_level_count(width, height); ++level) {
+        int x0 = x >> level;
+        int y0 = y >> level;
+        int mw = ((x + w - 1) >> level) - x0 + 1;
+        int mh = ((y + h - 1) >> level) - y0 + 1;
+        mip.resize(mw * mh * ts);
+        uint8_t* out = mip.data();
+        for (int my = y0; my < y0 + mh; ++my)
+        for (int mx = x0; mx < x0 + mw; ++mx) {
+            sum.fill(0);
+            int n = 0;
+            for (int sy = my << level; sy < std::min((my + 1) << level, height); ++sy)
+            for (int sx = mx << level; sx < std::min((mx + 1) << level, width); ++sx) {
+                const uint8_t* p = img + (sy * width + sx) * ts;
+                for (int c = 0; c < components; ++c) {
+                    sum[c] += wide ? reinterpret_cast<const uint16_t*>(p)[c] : p[c];
+                }
+                ++n;
+            }
+            for (int c = 0; c < components; ++c) {
+                uint32_t v = (sum[c] + n / 2) / n;
+                if (wide) reinterpret_cast<uint16_t*>(out)[c] = v;
+                else out[c] = v;
+            }
+            out += ts;
+        }
+        upload_rect(target, level, layer, f, x0, y0, mw, mh, mip.data(), mw, pixel_buffer);
+    }
+}
+
+
+static void set_streaming(uint32_t& pixel_buffer, bool enabled) {
+    if (enabled && !pixel_buffer) glGenBuffers(1, &pixel_buffer);
+    if (!enabled && pixel_buffer) {
+        glDeleteBuffers(1, &pixel_buffer);
+        pixel_buffer = 0;
+    }
+}
+
+
 Texture2D::Texture2D() {
     glGenTextures(1, &m_handle);
 }
 Texture2D::~Texture2D() {
     glDeleteTextures(1, &m_handle);
+    if (m_pixel_buffer) glDeleteBuffers(1, &m_pixel_buffer);
 }
 bool Texture2D::init(const char* filename, FilterMode filter) {
     SDL_Surface* s = IMG_Load(filename);
@@ -279,27 +536,18 @@ bool Texture2D::init(TextureFormat format, int w, int h, void* data, FilterMode
     m_width  = w;
     m_height = h;
     m_format = format;
+    m_filter = filter;
 
     cache.bind_texture(0, GL_TEXTURE_2D, m_handle);
 
-    if (filter == FilterMode::Nearest) {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    }
-    else {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        if (filter == FilterMode::Trilinear) {
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        }
-        else {
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        }
-    }
+    set_filter(GL_TEXTURE_2D, filter);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, map_to_gl(m_format), m_width, m_height, 0, map_to_gl(m_format), GL_UNSIGNED_BYTE, data);
+    GlTextureFormat f = map_to_gl(m_format);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, f.unpack_alignment);
+    glTexImage2D(GL_TEXTURE_2D, 0, f.internal_format, m_width, m_height, 0, f.format, f.type, data);
 
     if (filter == FilterMode::Trilinear) {
         glGenerateMipmap(GL_TEXTURE_2D);
@@ -307,6 +555,89 @@ bool Texture2D::init(TextureFormat format, int w, int h, void* data, FilterMode
 
     return true;
 }
+bool Texture2D::init(TextureFormat format, int w, int h, const std::vector<const void*>& levels, FilterMode filter) {
+    m_width  = w;
+    m_height = h;
+    m_format = format;
+    m_filter = filter;
+
+    cache.bind_texture(0, GL_TEXTURE_2D, m_handle);
+
+    set_filter(GL_TEXTURE_2D, filter);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels.size() - 1);
+
+    GlTextureFormat f = map_to_gl(m_format);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, f.unpack_alignment);
+    for (int i = 0; i < (int) levels.size(); ++i) {
+        glTexImage2D(GL_TEXTURE_2D, i, f.internal_format, std::max(1, m_width >> i), std::max(1, m_height >> i),
+                     0, f.format, f.type, levels[i]);
+    }
+
+    return true;
+}
+void Texture2D::update(int x, int y, int w, int h, const void* image) {
+    cache.bind_texture(0, GL_TEXTURE_2D, m_handle);
+    update_rect(GL_TEXTURE_2D, 0, m_format, m_filter, m_width, m_height, x, y, w, h, image, m_pixel_buffer);
+}
+void Texture2D::set_streaming(bool enabled) {
+    rmw::set_streaming(m_pixel_buffer, enabled);
+}
+
+
+
+Texture2DArray::Texture2DArray() {
+    glGenTextures(1, &m_handle);
+}
+Texture2DArray::~Texture2DArray() {
+    glDeleteTextures(1, &m_handle);
+    if (m_pixel_buffer) glDeleteBuffers(1, &m_pixel_buffer);
+}
+bool Texture2DArray::init(TextureFormat format, int w, int h, int layers, FilterMode filter) {
+    m_width  = w;
+    m_height = h;
+    m_layers = layers;
+    m_format = format;
+    m_filter = filter;
+
+    cache.bind_texture(0, GL_TEXTURE_2D_ARRAY, m_handle);
+
+    set_filter(GL_TEXTURE_2D_ARRAY, filter);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // allocate all levels up front so that partial updates never leave the texture incomplete
+    GlTextureFormat f = map_to_gl(m_format);
+    int levels = filter == FilterMode::Trilinear ? mip_level_count(m_width, m_height) : 1;
+    for (int level = 0; level < levels; ++level) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, f.internal_format,
+                     std::max(1, m_width >> level), std::max(1, m_height >> level), m_layers,
+                     0, f.format, f.type, nullptr);
+    }
+
+    return true;
+}
+void Texture2DArray::set_layer(int layer, const void* data) {
+    cache.bind_texture(0, GL_TEXTURE_2D_ARRAY, m_handle);
+
+    GlTextureFormat f = map_to_gl(m_format);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, f.unpack_alignment);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, m_width, m_height, 1, f.format, f.type, data);
+
+    if (m_filter == FilterMode::Trilinear) {
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+}
+void Texture2DArray::update(int layer, int x, int y, int w, int h, const void* image) {
+    assert(layer >= 0 && layer < m_layers);
+    cache.bind_texture(0, GL_TEXTURE_2D_ARRAY, m_handle);
+    update_rect(GL_TEXTURE_2D_ARRAY, layer, m_format, m_filter, m_width, m_height, x, y, w, h, image, m_pixel_buffer);
+}
+void Texture2DArray::set_streaming(bool enabled) {
+    rmw::set_streaming(m_pixel_buffer, enabled);
+}
 
 
 
@@ -352,6 +683,10 @@ bool Context::init(int width, int height, const char* title) {
 //    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
 //    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 //    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+#ifdef __EMSCRIPTEN__
+    // WebGL 2, the map shaders need GLSL ES 3.00
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+#endif
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
 
@@ -407,11 +742,32 @@ void Context::clear(const ClearState& cs, const Framebuffer::Ptr& fb) {
 
     cache.bind_framebuffer(fb->m_handle);
 
+    // glClear respects the write masks
+    if (!m_render_state.color_write_enabled) {
+        m_render_state.color_write_enabled = true;
+        glColorMask(true, true, true, true);
+    }
+    if (!m_render_state.depth_write_enabled) {
+        m_render_state.depth_write_enabled = true;
+        glDepthMask(true);
+    }
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
 
 void Context::sync_render_state(const RenderState& rs) {
+    // write masks
+    if (m_render_state.color_write_enabled != rs.color_write_enabled) {
+        m_render_state.color_write_enabled = rs.color_write_enabled;
+        bool b = m_render_state.color_write_enabled;
+        glColorMask(b, b, b, b);
+    }
+    if (m_render_state.depth_write_enabled != rs.depth_write_enabled) {
+        m_render_state.depth_write_enabled = rs.depth_write_enabled;
+        glDepthMask(m_render_state.depth_write_enabled);
+    }
+
     // depth
     if (m_render_state.depth_test_enabled != rs.depth_test_enabled) {
         m_render_state.depth_test_enabled = rs.depth_test_enabled;
@@ -531,6 +887,13 @@ void Context::flip_buffers() const {
 }
 
 
+void Context::read_pixels(const Framebuffer::Ptr& fb, std::vector<glm::u8vec4>& pixels) {
+    pixels.resize(fb->m_width * fb->m_height);
+    cache.bind_framebuffer(fb->m_handle);
+    glReadPixels(0, 0, fb->m_width, fb->m_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+}
+
+
 
 rmw::Context context;
 
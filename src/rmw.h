@@ -45,6 +45,10 @@ enum class BlendEquation { Add, Subtract, ReverseSubtract };
 struct RenderState {
     Viewport      viewport;
 
+    // write masks
+    bool          color_write_enabled     = true;
+    bool          depth_write_enabled     = true;
+
     // depth
     bool          depth_test_enabled      = false;
     DepthTestFunc depth_test_func         = DepthTestFunc::LEqual;
@@ -77,6 +81,8 @@ public:
     virtual ~GpuBuffer();
 
     void init_data(const void* data, int size);
+    // overwrite part of the data, the buffer keeps its size
+    void update_data(int offset, const void* data, int size);
 
     int size() const { return m_size; }
 
@@ -175,7 +181,9 @@ private:
 
 //enum class WrapMode { Clamp, Repeat, ClampZero, MirrowedRepeat };
 enum class FilterMode { Nearest, Linear, Trilinear };
-enum class TextureFormat { RGB, RGBA, Depth, Stencil, DepthStencil };
+// R8 and R16 need GL 3 / GLES 3 (R16 on WebGL 2 needs EXT_texture_norm16), Luminance works with GLES 2
+// single channel data is expected to be tightly packed
+enum class TextureFormat { RGB, RGBA, Depth, Stencil, DepthStencil, R8, R16, Luminance };
 
 
 class Texture2D {
@@ -189,6 +197,16 @@ public:
     bool init(SDL_Surface* s, FilterMode filter = FilterMode::Trilinear);
     bool init(const char* filename, FilterMode filter = FilterMode::Trilinear);
     bool init(TextureFormat format, int w, int h, void* data = nullptr, FilterMode filter = FilterMode::Nearest);
+    // precomputed mipmaps, level 0 first
+    bool init(TextureFormat format, int w, int h, const std::vector<const void*>& levels,
+              FilterMode filter = FilterMode::Trilinear);
+
+    // upload the rect x, y, w, h of image, which holds the whole level 0 tightly packed
+    // trilinear textures get their mipmaps rebuilt for that rect only
+    void update(int x, int y, int w, int h, const void* image);
+
+    // stage updates through a pixel unpack buffer so the copy can overlap with rendering
+    void set_streaming(bool enabled);
 
     // TODO: sampler stuff
 //    void set_wrap(WrapMode horiz, WrapMode vert);
@@ -206,7 +224,46 @@ private:
     int           m_width;
     int           m_height;
     TextureFormat m_format;
+    FilterMode    m_filter;
     uint32_t      m_handle;
+    uint32_t      m_pixel_buffer = 0;
+};
+
+
+// layered texture, sampled with sampler2DArray
+class Texture2DArray {
+    friend class Context;
+    friend class Shader;
+public:
+    typedef std::unique_ptr<Texture2DArray> Ptr;
+    ~Texture2DArray();
+
+    bool init(TextureFormat format, int w, int h, int layers, FilterMode filter = FilterMode::Nearest);
+
+    // replace the whole layer
+    void set_layer(int layer, const void* data);
+
+    // like Texture2D::update, image holds the whole layer
+    void update(int layer, int x, int y, int w, int h, const void* image);
+    void set_streaming(bool enabled);
+
+    int get_width() const    { return m_width; }
+    int get_height() const   { return m_height; }
+    int get_layers() const   { return m_layers; }
+
+private:
+    Texture2DArray(const Texture2DArray&) = delete;
+    Texture2DArray& operator=(const Texture2DArray&) = delete;
+    Texture2DArray();
+
+
+    int           m_width;
+    int           m_height;
+    int           m_layers;
+    TextureFormat m_format;
+    FilterMode    m_filter;
+    uint32_t      m_handle;
+    uint32_t      m_pixel_buffer = 0;
 };
 
 
@@ -267,6 +324,17 @@ public:
         }
         assert(false);
     }
+    void set_uniform(const std::string& name, const Texture2DArray::Ptr& texture) {
+        for (auto& u : m_uniforms) {
+            if (u->name == name) {
+                auto* ue = dynamic_cast<UniformTexture2DArray*>(u.get());
+                assert(ue);
+                ue->set(texture);
+                return;
+            }
+        }
+        assert(false);
+    }
 
 
     ~Shader();
@@ -301,6 +369,13 @@ private:
         uint32_t        handle;
     };
 
+    struct UniformTexture2DArray : Uniform {
+        UniformTexture2DArray(const std::string& name, uint32_t type, int location) : Uniform(name, type, location) {}
+        void update() const override;
+        void set(const Texture2DArray::Ptr& texture) { handle = texture->m_handle; }
+        uint32_t        handle;
+    };
+
     template <class T>
     struct UniformExtend : Uniform {
         UniformExtend(const std::string& name, uint32_t type, int location) : Uniform(name, type, location) {}
@@ -353,6 +428,8 @@ public:
 
     void flip_buffers() const;
 
+    void read_pixels(const Framebuffer::Ptr& fb, std::vector<glm::u8vec4>& pixels);
+
 
     Shader::Ptr create_shader(const char* vs, const char* fs) const {
         Shader::Ptr s(new Shader());
@@ -383,6 +460,13 @@ public:
         return t;
     }
 
+    template<typename... Args>
+    Texture2DArray::Ptr create_texture_2D_array(Args&&... args) const {
+        Texture2DArray::Ptr t(new Texture2DArray());
+        if (!t->init(std::forward<Args>(args)...)) return nullptr;
+        return t;
+    }
+
     const Framebuffer::Ptr& get_default_framebuffer() {
         return m_default_framebuffer;
     }
@@ -0,0 +1,92 @@
+#include "simulation.h"
+#include "eye.h"
+
+#include <algorithm>
+
+
+Simulation simulation;
+
+
+Simulation::~Simulation() {
+    shutdown();
+}
+
+
+void Simulation::init(bool threaded) {
+#ifdef __EMSCRIPTEN__
+    threaded = false;
+#endif
+    // there is a frame before anything is drawn
+    m_last_time = std::chrono::steady_clock::now();
+    simulate(m_frames.back(), SDL_GetKeyboardState(nullptr));
+    m_frames.publish();
+    m_frames.acquire();
+
+    if (!threaded) return;
+    m_running = true;
+    m_thread = std::thread(&Simulation::run, this);
+}
+
+
+void Simulation::shutdown() {
+    if (!m_thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        m_running = false;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+
+const Frame& Simulation::next_frame() {
+    const Uint8* keys = SDL_GetKeyboardState(nullptr);
+    if (!m_thread.joinable()) {
+        simulate(m_frames.back(), keys);
+        m_frames.publish();
+    }
+    else {
+        std::copy(keys, keys + SDL_NUM_SCANCODES, m_keys.back().begin());
+        m_keys.publish();
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_requested = true;
+        }
+        m_wake.notify_one();
+    }
+    // threaded, this is usually the frame requested last time.
+    // if it isn't finished yet, the previous one is drawn again
+    m_frames.acquire();
+    return m_frames.front();
+}
+
+
+void Simulation::simulate(Frame& frame, const Uint8* keys) {
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<float> dt = now - m_last_time;
+    m_last_time = now;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    eye.update(dt.count(), keys);
+    frame.view_mtx     = eye.get_view_mtx();
+    frame.view_loc     = eye.get_view_location();
+    frame.loc          = eye.get_location();
+    frame.map_revision = map.revision;
+    map.get_sector_order(frame.view_loc.sector_nr, frame.sector_order);
+}
+
+
+void Simulation::run() {
+    Keys keys = {};
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+            m_wake.wait(lock, [this]() { return m_requested || !m_running; });
+            if (!m_running) return;
+            m_requested = false;
+        }
+        if (m_keys.acquire()) keys = m_keys.front();
+        simulate(m_frames.back(), keys.data());
+        m_frames.publish();
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "map.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include <SDL2/SDL.h>
+
+
+// everything drawing needs of one simulated frame. never changed once handed over
+struct Frame {
+    glm::mat4        view_mtx;
+    // blended between the last two ticks, for drawing
+    Location         view_loc;
+    // the last ticked location, which gameplay and streaming follow
+    Location         loc;
+    // sectors front to back from the eye, only valid while map.revision is still the same
+    int              map_revision;
+    std::vector<int> sector_order;
+};
+
+
+// hands the latest value from one producer thread to one consumer thread without locking.
+// each side owns a slot, the third one is swapped in and out between them
+template <class T>
+class TripleBuffer {
+public:
+    T&       back() { return m_slots[m_back]; }
+    const T& front() const { return m_slots[m_front]; }
+    // producer: pass on the back slot and get a free one
+    void publish() {
+        m_back = m_middle.exchange(m_back | FRESH) & INDEX;
+    }
+    // consumer: switch to the latest published slot, false if nothing new was published
+    bool acquire() {
+        if (!(m_middle.load() & FRESH)) return false;
+        m_front = m_middle.exchange(m_front) & INDEX;
+        return true;
+    }
+
+private:
+    enum { INDEX = 3, FRESH = 4 };
+    std::array<T, 3> m_slots;
+    int              m_back   = 0;
+    std::atomic<int> m_middle { 1 };
+    int              m_front  = 2;
+};
+
+
+// steps the eye and builds the frames to draw. threaded, the next frame is simulated
+// while the current one is drawn; the draw thread then only reads finished frames.
+// the browser build always runs single threaded.
+class Simulation {
+public:
+    ~Simulation();
+    void init(bool threaded);
+    void shutdown();
+    // once per drawn frame, on the thread that polls SDL events
+    const Frame& next_frame();
+    // held while simulating. anyone else changing the map or the eye takes it first
+    std::mutex& get_mutex() { return m_mutex; }
+
+private:
+    typedef std::array<Uint8, SDL_NUM_SCANCODES> Keys;
+
+    void simulate(Frame& frame, const Uint8* keys);
+    void run();
+
+    std::mutex                            m_mutex;
+    std::chrono::steady_clock::time_point m_last_time;
+    TripleBuffer<Frame>                   m_frames;
+    // keyboard state sampled on the event thread
+    TripleBuffer<Keys>                    m_keys;
+
+    std::thread                           m_thread;
+    std::atomic<bool>                     m_running { false };
+    std::mutex                            m_wake_mutex;
+    std::condition_variable               m_wake;
+    bool                                  m_requested = false;
+};
+
+
+extern Simulation simulation;
@@ -0,0 +1,153 @@
+#include "texture_loader.h"
+#include "ktx2.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+
+void TextureLoader::init() {
+#ifndef __EMSCRIPTEN__
+    int count = std::max(1, std::min<int>(4, std::thread::hardware_concurrency()));
+    for (int i = 0; i < count; ++i) m_threads.emplace_back(&TextureLoader::work, this);
+#endif
+}
+
+
+TextureLoader::~TextureLoader() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    for (std::thread& t : m_threads) t.join();
+}
+
+
+void TextureLoader::load(rmw::Texture2D& texture, const std::string& name, rmw::FilterMode filter) {
+    JobPtr job(new Job());
+    job->texture = &texture;
+    job->name    = name;
+    job->filter  = filter;
+    ++m_pending;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_todo.push_back(std::move(job));
+    }
+    m_cond.notify_one();
+}
+
+
+void TextureLoader::work() {
+    for (;;) {
+        JobPtr job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]{ return m_quit || !m_todo.empty(); });
+            if (m_quit) return;
+            job = std::move(m_todo.front());
+            m_todo.pop_front();
+        }
+        decode(*job);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done.push_back(std::move(job));
+    }
+}
+
+
+void TextureLoader::poll(int max_uploads) {
+    for (int i = 0; i < max_uploads && m_pending > 0; ++i) {
+        JobPtr job;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_done.empty()) {
+                job = std::move(m_done.front());
+                m_done.pop_front();
+            }
+            else if (m_threads.empty() && !m_todo.empty()) {
+                // no workers, decode one texture per upload on the main thread
+                job = std::move(m_todo.front());
+                m_todo.pop_front();
+            }
+        }
+        if (!job) return;
+        if (m_threads.empty()) decode(*job);
+        --m_pending;
+
+        if (!job->ok) {
+            fprintf(stderr, "Error: can't load texture '%s'\n", job->name.c_str());
+            continue;
+        }
+        if (job->levels.size() == 1) {
+            job->texture->init(job->format, job->width, job->height, job->levels[0].data(), job->filter);
+        }
+        else {
+            std::vector<const void*> levels;
+            for (const std::vector<uint8_t>& l : job->levels) levels.push_back(l.data());
+            job->texture->init(job->format, job->width, job->height, levels, job->filter);
+        }
+    }
+}
+
+
+void TextureLoader::decode(Job& job) {
+    job.ok = decode_ktx2(job, (job.name + ".ktx2").c_str())
+          || decode_png(job, (job.name + ".png").c_str());
+}
+
+
+bool TextureLoader::decode_ktx2(Job& job, const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) return false;
+
+    ktx2::Header h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1
+           && memcmp(h.identifier, ktx2::IDENTIFIER, sizeof(h.identifier)) == 0
+           && (h.vk_format == ktx2::VK_FORMAT_R8G8B8A8_UNORM || h.vk_format == ktx2::VK_FORMAT_R8G8B8A8_SRGB)
+           && h.pixel_depth == 0 && h.layer_count == 0 && h.face_count == 1
+           && h.supercompression_scheme == 0 && h.level_count > 0;
+
+    std::vector<ktx2::LevelIndex> index(ok ? h.level_count : 0);
+    ok = ok && fread(index.data(), sizeof(ktx2::LevelIndex), index.size(), f) == index.size();
+
+    job.levels.resize(index.size());
+    for (int i = 0; ok && i < (int) index.size(); ++i) {
+        int w = std::max(1u, h.pixel_width >> i);
+        int hh = std::max(1u, h.pixel_height >> i);
+        ok = index[i].byte_length == uint64_t(w * hh * 4)
+          && fseek(f, index[i].byte_offset, SEEK_SET) == 0;
+        if (!ok) break;
+        job.levels[i].resize(index[i].byte_length);
+        ok = fread(job.levels[i].data(), job.levels[i].size(), 1, f) == 1;
+    }
+    fclose(f);
+    if (!ok) {
+        job.levels.clear();
+        return false;
+    }
+
+    job.format = rmw::TextureFormat::RGBA;
+    job.width  = h.pixel_width;
+    job.height = h.pixel_height;
+    return true;
+}
+
+
+bool TextureLoader::decode_png(Job& job, const char* filename) {
+    SDL_Surface* s = IMG_Load(filename);
+    if (!s) return false;
+    if (s->format->BytesPerPixel != 3 && s->format->BytesPerPixel != 4) {
+        SDL_Surface* t = SDL_ConvertSurfaceFormat(s, SDL_PIXELFORMAT_RGBA32, 0);
+        SDL_FreeSurface(s);
+        if (!t) return false;
+        s = t;
+    }
+    // rows stay padded to 4 bytes, which matches the unpack alignment of RGB textures
+    job.format = s->format->BytesPerPixel == 4 ? rmw::TextureFormat::RGBA : rmw::TextureFormat::RGB;
+    job.width  = s->w;
+    job.height = s->h;
+    job.levels.resize(1);
+    job.levels[0].assign((uint8_t*) s->pixels, (uint8_t*) s->pixels + s->pitch * s->h);
+    SDL_FreeSurface(s);
+    return true;
+}
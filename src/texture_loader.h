@@ -0,0 +1,57 @@
+#pragma once
+
+#include "rmw.h"
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+
+// decodes textures on worker threads and uploads a few of them per frame,
+// so the first frames show up before all textures are resident.
+// textures keep whatever they were initialized with until their data arrives.
+class TextureLoader {
+public:
+    ~TextureLoader();
+
+    void init();
+
+    // name is given without extension, a cooked name.ktx2 is preferred over name.png
+    void load(rmw::Texture2D& texture, const std::string& name,
+              rmw::FilterMode filter = rmw::FilterMode::Trilinear);
+
+    // upload at most max_uploads decoded textures, call once per frame from the main thread
+    void poll(int max_uploads = 1);
+
+    bool is_done() const { return m_pending == 0; }
+
+private:
+    struct Job {
+        rmw::Texture2D*                   texture;
+        std::string                       name;
+        rmw::FilterMode                   filter;
+
+        bool                              ok;
+        rmw::TextureFormat                format;
+        int                               width;
+        int                               height;
+        // png files get their mipmaps generated on upload, ktx2 files bring them along
+        std::vector<std::vector<uint8_t>> levels;
+    };
+    typedef std::unique_ptr<Job> JobPtr;
+
+    static void decode(Job& job);
+    static bool decode_ktx2(Job& job, const char* filename);
+    static bool decode_png(Job& job, const char* filename);
+    void work();
+
+
+    std::vector<std::thread> m_threads;
+    std::mutex               m_mutex;
+    std::condition_variable  m_cond;
+    std::deque<JobPtr>       m_todo;
+    std::deque<JobPtr>       m_done;
+    int                      m_pending = 0;
+    bool                     m_quit    = false;
+};
@@ -0,0 +1,159 @@
+#include "undo_history.h"
+
+#include <cassert>
+
+
+// memory kept for undo and redo steps in bytes, the oldest steps go first
+#ifndef EDITOR_UNDO_MEMORY
+#define EDITOR_UNDO_MEMORY (64 << 20)
+#endif
+
+
+void UndoHistory::save_state(const Sector& s, SectorState& state) {
+    state.walls.clear();
+    for (const Wall& w : s.walls) state.walls.push_back(w.pos);
+    state.floor_height = s.floor_height;
+    state.ceil_height  = s.ceil_height;
+}
+
+
+void UndoHistory::swap_state(Sector& s, SectorState& state) {
+    SectorState old;
+    save_state(s, old);
+    s.walls.resize(state.walls.size());
+    for (int i = 0; i < (int) s.walls.size(); ++i) s.walls[i].pos = state.walls[i];
+    s.floor_height = state.floor_height;
+    s.ceil_height  = state.ceil_height;
+    state = std::move(old);
+}
+
+
+size_t UndoHistory::step_memory(const Step& step) {
+    size_t memory = sizeof(Step) + step.ops.capacity() * sizeof(Op);
+    for (const Op& op : step.ops) memory += op.state.walls.capacity() * sizeof(glm::vec2);
+    return memory;
+}
+
+
+void UndoHistory::apply(std::vector<Sector>& sectors, Op& op, bool forward) {
+    if (op.type == OpType::Modify) {
+        swap_state(sectors[op.sector_nr], op.state);
+        return;
+    }
+    if ((op.type == OpType::Insert) == forward) {
+        // a fresh sector has no faces yet, setup_portals builds them
+        Sector s;
+        swap_state(s, op.state);
+        sectors.insert(sectors.begin() + op.sector_nr, std::move(s));
+    }
+    else {
+        save_state(sectors[op.sector_nr], op.state);
+        sectors.erase(sectors.begin() + op.sector_nr);
+    }
+}
+
+
+void UndoHistory::modified_sectors(const Step& step, std::vector<int>& modified) {
+    modified.clear();
+    for (const Op& op : step.ops) {
+        if (op.type != OpType::Modify) {
+            modified.clear();
+            return;
+        }
+        modified.push_back(op.sector_nr);
+    }
+}
+
+
+void UndoHistory::begin() {
+    if (m_depth++ > 0) return;
+    m_step = {};
+    m_touched.clear();
+}
+
+
+void UndoHistory::end() {
+    if (m_depth == 0 || --m_depth > 0) return;
+    m_touched.clear();
+    if (m_step.ops.empty()) return;
+
+    for (const Step& step : m_redo) m_memory -= step.memory;
+    m_redo.clear();
+    m_step.ops.shrink_to_fit();
+    m_step.memory = step_memory(m_step);
+    m_memory += m_step.memory;
+    m_undo.push_back(std::move(m_step));
+    while (m_memory > EDITOR_UNDO_MEMORY && m_undo.size() > 1) {
+        m_memory -= m_undo.front().memory;
+        m_undo.pop_front();
+    }
+}
+
+
+void UndoHistory::clear() {
+    m_undo.clear();
+    m_redo.clear();
+    m_memory = 0;
+    m_depth  = 0;
+    m_touched.clear();
+}
+
+
+void UndoHistory::record_modify(const std::vector<Sector>& sectors, int sector_nr) {
+    assert(m_depth > 0);
+    if (!m_touched.insert(sector_nr).second) return;
+    m_step.ops.push_back({ OpType::Modify, sector_nr, {} });
+    save_state(sectors[sector_nr], m_step.ops.back().state);
+}
+
+
+void UndoHistory::record_insert(int sector_nr) {
+    assert(m_depth > 0);
+    m_touched.clear();
+    m_step.ops.push_back({ OpType::Insert, sector_nr, {} });
+}
+
+
+void UndoHistory::record_erase(const std::vector<Sector>& sectors, int sector_nr) {
+    assert(m_depth > 0);
+    m_touched.clear();
+    m_step.ops.push_back({ OpType::Erase, sector_nr, {} });
+    save_state(sectors[sector_nr], m_step.ops.back().state);
+}
+
+
+bool UndoHistory::undo(std::vector<Sector>& sectors, std::vector<int>& modified) {
+    // an open step is finished first
+    if (m_depth > 0) {
+        m_depth = 1;
+        end();
+    }
+    if (m_undo.empty()) return false;
+    Step step = std::move(m_undo.back());
+    m_undo.pop_back();
+    for (int i = step.ops.size() - 1; i >= 0; --i) apply(sectors, step.ops[i], false);
+    modified_sectors(step, modified);
+    m_memory -= step.memory;
+    step.memory = step_memory(step);
+    m_memory += step.memory;
+    m_redo.push_back(std::move(step));
+    return true;
+}
+
+
+bool UndoHistory::redo(std::vector<Sector>& sectors, std::vector<int>& modified) {
+    if (m_depth > 0) {
+        m_depth = 1;
+        end();
+    }
+    if (m_redo.empty()) return false;
+    Step step = std::move(m_redo.back());
+    m_redo.pop_back();
+    for (Op& op : step.ops) apply(sectors, op, true);
+    modified_sectors(step, modified);
+    m_memory -= step.memory;
+    step.memory = step_memory(step);
+    m_memory += step.memory;
+    m_undo.push_back(std::move(step));
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "map.h"
+
+#include <deque>
+#include <unordered_set>
+
+
+// undo and redo for editor operations.
+// a step records the sectors an operation touches before it touches them:
+// their wall positions and heights, plus where sectors were inserted or erased.
+// portals and faces are derived and come back through Map::relink_sectors for the sectors
+// a step modified, or setup_portals if it inserted or erased any. old steps are dropped beyond EDITOR_UNDO_MEMORY bytes.
+class UndoHistory {
+public:
+    // steps nest, only the outermost begin and end count. steps that record nothing are dropped.
+    void begin();
+    void end();
+    void clear();
+
+    // call before sector_nr is changed
+    void record_modify(const std::vector<Sector>& sectors, int sector_nr);
+    // call after a sector was inserted at sector_nr
+    void record_insert(int sector_nr);
+    // call before sector_nr is erased
+    void record_erase(const std::vector<Sector>& sectors, int sector_nr);
+
+    // false if there is nothing to undo or redo. modified gets the sectors the step changed,
+    // it is left empty if the step inserted or erased sectors
+    bool undo(std::vector<Sector>& sectors, std::vector<int>& modified);
+    bool redo(std::vector<Sector>& sectors, std::vector<int>& modified);
+
+    size_t memory() const { return m_memory; }
+
+private:
+    struct SectorState {
+        std::vector<glm::vec2> walls;
+        float                  floor_height;
+        float                  ceil_height;
+    };
+
+    enum class OpType { Modify, Insert, Erase };
+
+    // holds the state of the other side: before the op while it is done, after it once undone
+    struct Op {
+        OpType      type;
+        int         sector_nr;
+        SectorState state;
+    };
+
+    struct Step {
+        std::vector<Op> ops;
+        size_t          memory;
+    };
+
+    static void   save_state(const Sector& s, SectorState& state);
+    static void   swap_state(Sector& s, SectorState& state);
+    static size_t step_memory(const Step& step);
+    static void   apply(std::vector<Sector>& sectors, Op& op, bool forward);
+    static void   modified_sectors(const Step& step, std::vector<int>& modified);
+
+    std::deque<Step>        m_undo;
+    std::vector<Step>       m_redo;
+    Step                    m_step;
+    size_t                  m_memory = 0;
+    int                     m_depth  = 0;
+    // sectors saved by the open step, only valid until sectors are renumbered
+    std::unordered_set<int> m_touched;
+};
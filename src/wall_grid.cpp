@@ -0,0 +1,155 @@
+#include "wall_grid.h"
+#include "math.h"
+
+#include <algorithm>
+
+
+// edge length of the grid cells in map units
+#ifndef WALL_GRID_CELL_SIZE
+#define WALL_GRID_CELL_SIZE 8.0f
+#endif
+
+
+glm::ivec2 WallGrid::cell_pos(const glm::vec2& p) {
+    return glm::ivec2(glm::floor(p / WALL_GRID_CELL_SIZE));
+}
+
+
+template <class Func>
+void WallGrid::for_cells(glm::vec2 r1, glm::vec2 r2, Func f) const {
+    glm::ivec2 c1 = cell_pos(glm::min(r1, r2));
+    glm::ivec2 c2 = cell_pos(glm::max(r1, r2));
+    // big rects walk the occupied cells instead
+    if ((long long) (c2.x - c1.x + 1) * (c2.y - c1.y + 1) > (long long) m_cells.size()) {
+        for (const auto& it : m_cells) {
+            int x = it.first >> 32;
+            int y = (int) (uint32_t) it.first;
+            if (x >= c1.x && x <= c2.x && y >= c1.y && y <= c2.y) f(it.second);
+        }
+        return;
+    }
+    for (int y = c1.y; y <= c2.y; ++y)
+    for (int x = c1.x; x <= c2.x; ++x) {
+        auto it = m_cells.find(cell_key(x, y));
+        if (it != m_cells.end()) f(it->second);
+    }
+}
+
+
+void WallGrid::build(const std::vector<Sector>& sectors) {
+    m_cells.clear();
+    for (int i = 0; i < (int) sectors.size(); ++i) {
+        for (int j = 0; j < (int) sectors[i].walls.size(); ++j) {
+            insert_vertex(sectors, { i, j });
+            insert_segment(sectors, { i, j });
+        }
+    }
+}
+
+
+void WallGrid::insert_vertex(const std::vector<Sector>& sectors, const WallRef& ref) {
+    glm::ivec2 c = cell_pos(sectors[ref.sector_nr].walls[ref.wall_nr].pos);
+    m_cells[cell_key(c.x, c.y)].vertices.push_back(ref);
+}
+
+
+void WallGrid::remove_vertex(const std::vector<Sector>& sectors, const WallRef& ref) {
+    glm::ivec2 c = cell_pos(sectors[ref.sector_nr].walls[ref.wall_nr].pos);
+    auto it = m_cells.find(cell_key(c.x, c.y));
+    if (it == m_cells.end()) return;
+    std::vector<WallRef>& refs = it->second.vertices;
+    auto r = std::find(refs.begin(), refs.end(), ref);
+    if (r == refs.end()) return;
+    *r = refs.back();
+    refs.pop_back();
+    if (refs.empty() && it->second.segments.empty()) m_cells.erase(it);
+}
+
+
+void WallGrid::insert_segment(const std::vector<Sector>& sectors, const WallRef& ref) {
+    const std::vector<Wall>& walls = sectors[ref.sector_nr].walls;
+    glm::vec2 p1 = walls[ref.wall_nr].pos;
+    glm::vec2 p2 = walls[(ref.wall_nr + 1) % walls.size()].pos;
+    glm::ivec2 c1 = cell_pos(glm::min(p1, p2));
+    glm::ivec2 c2 = cell_pos(glm::max(p1, p2));
+    for (int y = c1.y; y <= c2.y; ++y)
+    for (int x = c1.x; x <= c2.x; ++x) m_cells[cell_key(x, y)].segments.push_back(ref);
+}
+
+
+void WallGrid::remove_segment(const std::vector<Sector>& sectors, const WallRef& ref) {
+    const std::vector<Wall>& walls = sectors[ref.sector_nr].walls;
+    glm::vec2 p1 = walls[ref.wall_nr].pos;
+    glm::vec2 p2 = walls[(ref.wall_nr + 1) % walls.size()].pos;
+    glm::ivec2 c1 = cell_pos(glm::min(p1, p2));
+    glm::ivec2 c2 = cell_pos(glm::max(p1, p2));
+    for (int y = c1.y; y <= c2.y; ++y)
+    for (int x = c1.x; x <= c2.x; ++x) {
+        auto it = m_cells.find(cell_key(x, y));
+        if (it == m_cells.end()) continue;
+        std::vector<WallRef>& refs = it->second.segments;
+        auto r = std::find(refs.begin(), refs.end(), ref);
+        if (r == refs.end()) continue;
+        *r = refs.back();
+        refs.pop_back();
+        if (refs.empty() && it->second.vertices.empty()) m_cells.erase(it);
+    }
+}
+
+
+WallRef WallGrid::nearest_vertex(const std::vector<Sector>& sectors, const glm::vec2& p, float max_dist) const {
+    WallRef best = { -1, -1 };
+    float best_dist = max_dist * max_dist;
+    for_cells(p - glm::vec2(max_dist), p + glm::vec2(max_dist), [&](const Cell& cell) {
+        for (const WallRef& ref : cell.vertices) {
+            float d = glm::distance2(p, sectors[ref.sector_nr].walls[ref.wall_nr].pos);
+            // ties go to the first wall, like a scan in map order would
+            if (d < best_dist || (d == best_dist && best.sector_nr != -1 && ref < best)) {
+                best_dist = d;
+                best = ref;
+            }
+        }
+    });
+    return best;
+}
+
+
+WallRef WallGrid::nearest_segment(const std::vector<Sector>& sectors, const glm::vec2& p, float max_dist) const {
+    WallRef best = { -1, -1 };
+    float best_dist = max_dist;
+    for_cells(p - glm::vec2(max_dist), p + glm::vec2(max_dist), [&](const Cell& cell) {
+        for (const WallRef& ref : cell.segments) {
+            const std::vector<Wall>& walls = sectors[ref.sector_nr].walls;
+            float d = point_to_line_segment_distance(p, walls[ref.wall_nr].pos,
+                                                     walls[(ref.wall_nr + 1) % walls.size()].pos);
+            if (d < best_dist || (d == best_dist && best.sector_nr != -1 && ref < best)) {
+                best_dist = d;
+                best = ref;
+            }
+        }
+    });
+    return best;
+}
+
+
+void WallGrid::find_vertices(const std::vector<Sector>& sectors, glm::vec2 r1, glm::vec2 r2,
+                             std::vector<WallRef>& refs) const {
+    size_t first = refs.size();
+    for_cells(r1, r2, [&](const Cell& cell) {
+        for (const WallRef& ref : cell.vertices) {
+            if (point_in_rect(sectors[ref.sector_nr].walls[ref.wall_nr].pos, r1, r2)) refs.push_back(ref);
+        }
+    });
+    std::sort(refs.begin() + first, refs.end());
+}
+
+
+void WallGrid::find_segments(glm::vec2 r1, glm::vec2 r2, std::vector<WallRef>& refs) const {
+    size_t first = refs.size();
+    for_cells(r1, r2, [&](const Cell& cell) {
+        refs.insert(refs.end(), cell.segments.begin(), cell.segments.end());
+    });
+    // segments spanning several cells show up once per cell
+    std::sort(refs.begin() + first, refs.end());
+    refs.erase(std::unique(refs.begin() + first, refs.end()), refs.end());
+}
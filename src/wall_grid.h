@@ -0,0 +1,46 @@
+#pragma once
+
+#include "map.h"
+
+#include <unordered_map>
+
+
+// uniform grid over wall vertices and wall segments for picking in the editor.
+// segment j of a sector runs from vertex j to vertex j + 1.
+// moved vertices are removed with their old positions and inserted again with the new ones,
+// anything that renumbers walls needs a rebuild.
+class WallGrid {
+public:
+    void build(const std::vector<Sector>& sectors);
+
+    void remove_vertex(const std::vector<Sector>& sectors, const WallRef& ref);
+    void insert_vertex(const std::vector<Sector>& sectors, const WallRef& ref);
+    void remove_segment(const std::vector<Sector>& sectors, const WallRef& ref);
+    void insert_segment(const std::vector<Sector>& sectors, const WallRef& ref);
+
+    // sector_nr is -1 if there is nothing within max_dist
+    WallRef nearest_vertex(const std::vector<Sector>& sectors, const glm::vec2& p, float max_dist) const;
+    WallRef nearest_segment(const std::vector<Sector>& sectors, const glm::vec2& p, float max_dist) const;
+    // sorted by sector and wall
+    void    find_vertices(const std::vector<Sector>& sectors, glm::vec2 r1, glm::vec2 r2,
+                          std::vector<WallRef>& refs) const;
+    // segments in the cells overlapping the rect, sorted by sector and wall
+    void    find_segments(glm::vec2 r1, glm::vec2 r2, std::vector<WallRef>& refs) const;
+
+private:
+    struct Cell {
+        std::vector<WallRef> vertices;
+        std::vector<WallRef> segments;
+    };
+
+    // shifted as unsigned, a negative x must not be shifted as a signed value
+    static unsigned long long cell_key(int x, int y) {
+        return (unsigned long long) (uint32_t) x << 32 | (uint32_t) y;
+    }
+    static glm::ivec2 cell_pos(const glm::vec2& p);
+    // call f for every existing cell overlapping the rect
+    template <class Func>
+    void for_cells(glm::vec2 r1, glm::vec2 r2, Func f) const;
+
+    std::unordered_map<unsigned long long, Cell> m_cells;
+};
@@ -0,0 +1,251 @@
+#include "world_streamer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// sectors this many portals away from the eye's sector get their chunks loaded
+#ifndef STREAM_PORTAL_DEPTH
+#define STREAM_PORTAL_DEPTH 6
+#endif
+
+// so do chunks whose bounds are closer to the eye than this
+#ifndef STREAM_RADIUS
+#define STREAM_RADIUS 40.0f
+#endif
+
+// face and vertex bytes kept resident before chunks out of reach get evicted
+#ifndef STREAM_BUDGET
+#define STREAM_BUDGET (32 << 20)
+#endif
+
+
+WorldStreamer::~WorldStreamer() {
+    close();
+}
+
+
+bool WorldStreamer::open(const char* name) {
+    close();
+    int fd = ::open(name, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return false;
+    const uint8_t* file = (const uint8_t*) data;
+
+    // load_pmap_data checks all arrays and ranges
+    if (!map.load_pmap_data(file, size, false)) {
+        munmap(data, size);
+        fprintf(stderr, "Error: '%s' is not a valid pmap file\n", name);
+        return false;
+    }
+    const pmap::Header* h = (const pmap::Header*) file;
+    if (h->chunks.count == 0) {
+        munmap(data, size);
+        fprintf(stderr, "Error: '%s' is not chunked\n", name);
+        return false;
+    }
+
+    m_file           = file;
+    m_size           = size;
+    m_header         = h;
+    m_sectors        = (const pmap::Sector*) (file + h->sectors.offset);
+    m_chunks         = (const pmap::Chunk*) (file + h->chunks.offset);
+    m_revision       = map.revision;
+    m_resident_bytes = 0;
+    m_chunk_sectors.assign(h->chunks.count, {});
+    m_chunk_states.assign(h->chunks.count, ChunkState::Evicted);
+    for (int i = 0; i < (int) h->sectors.count; ++i) m_chunk_sectors[m_sectors[i].chunk_nr].push_back(i);
+    m_depths.assign(h->sectors.count, -1);
+
+    m_quit = false;
+#ifndef __EMSCRIPTEN__
+    m_threads.emplace_back(&WorldStreamer::work, this);
+#endif
+    printf("streaming %d sectors in %d chunks\n", (int) h->sectors.count, (int) h->chunks.count);
+    return true;
+}
+
+
+void WorldStreamer::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    for (std::thread& t : m_threads) t.join();
+    m_threads.clear();
+    m_todo.clear();
+    m_done.clear();
+    if (m_file) munmap((void*) m_file, m_size);
+    m_file = nullptr;
+}
+
+
+void WorldStreamer::work() {
+    for (;;) {
+        JobPtr job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]{ return m_quit || !m_todo.empty(); });
+            if (m_quit) return;
+            job = std::move(m_todo.front());
+            m_todo.pop_front();
+        }
+        load(*job);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done.push_back(std::move(job));
+    }
+}
+
+
+// copying the chunk out of the mapping is what pages it in from disk
+void WorldStreamer::load(Job& job) const {
+    const pmap::Chunk& k = m_chunks[job.chunk_nr];
+    const pmap::Face* pf = (const pmap::Face*) (m_file + m_header->faces.offset) + k.first_face;
+    const MapVertex* pv = (const MapVertex*) (m_file + m_header->verts.offset) + k.first_vert;
+    const uint8_t* pt = m_file + m_header->texels.offset + k.first_texel;
+    job.faces.assign(pf, pf + k.face_count);
+    job.verts.assign(pv, pv + k.vert_count);
+    job.texels.assign(pt, pt + k.texel_count);
+}
+
+
+void WorldStreamer::install(const Job& job) {
+    const pmap::Chunk& k = m_chunks[job.chunk_nr];
+    int first_face = map.faces.size();
+    int first_vert = map.verts.size();
+
+    size_t texel_offset = 0;
+    int bytes_per_texel = map.shadow_atlas.get_bytes_per_texel();
+    for (const pmap::Face& p : job.faces) {
+        MapFace f = pmap_face(p);
+        f.first_vert += first_vert - k.first_vert;
+        map.faces.push_back(f);
+
+        // faces whose texels got cut short keep whatever the atlas holds
+        size_t bytes = f.shadow.w * f.shadow.h * bytes_per_texel;
+        if (texel_offset + bytes > job.texels.size()) continue;
+        map.shadow_atlas.write_region(f.shadow, job.texels.data() + texel_offset);
+        texel_offset += bytes;
+    }
+    map.verts.insert(map.verts.end(), job.verts.begin(), job.verts.end());
+
+    for (int nr : m_chunk_sectors[job.chunk_nr]) {
+        Sector& s = map.sectors[nr];
+        s.first_face = first_face + m_sectors[nr].first_face - k.first_face;
+        s.face_count = m_sectors[nr].face_count;
+    }
+    m_chunk_states[job.chunk_nr] = ChunkState::Resident;
+    m_resident_bytes += job.faces.size() * sizeof(MapFace) + job.verts.size() * sizeof(MapVertex);
+}
+
+
+void WorldStreamer::evict(int chunk_nr) {
+    // the ranges left behind are reclaimed by compact_faces
+    for (int nr : m_chunk_sectors[chunk_nr]) map.sectors[nr].face_count = 0;
+    const pmap::Chunk& k = m_chunks[chunk_nr];
+    m_resident_bytes -= k.face_count * sizeof(MapFace) + k.vert_count * sizeof(MapVertex);
+    m_chunk_states[chunk_nr] = ChunkState::Evicted;
+}
+
+
+void WorldStreamer::update(const Location& loc, int max_installs) {
+    if (!m_file) return;
+    if (map.revision != m_revision) {
+        printf("map edited, streaming stopped\n");
+        close();
+        return;
+    }
+
+    for (int i = 0; i < max_installs; ++i) {
+        JobPtr job;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_done.empty()) {
+                job = std::move(m_done.front());
+                m_done.pop_front();
+            }
+            else if (m_threads.empty() && !m_todo.empty()) {
+                // no workers, load one chunk per install on the main thread
+                job = std::move(m_todo.front());
+                m_todo.pop_front();
+            }
+        }
+        if (!job) break;
+        if (m_threads.empty()) load(*job);
+        install(*job);
+    }
+
+    // breadth-first over portals, limited to STREAM_PORTAL_DEPTH
+    int chunk_count = m_chunk_states.size();
+    std::vector<bool> wanted(chunk_count);
+    m_queue.clear();
+    if (loc.sector_nr >= 0 && loc.sector_nr < (int) m_depths.size()) {
+        m_depths[loc.sector_nr] = 0;
+        m_queue.push_back(loc.sector_nr);
+    }
+    for (int q = 0; q < (int) m_queue.size(); ++q) {
+        int nr = m_queue[q];
+        wanted[m_sectors[nr].chunk_nr] = true;
+        if (m_depths[nr] == STREAM_PORTAL_DEPTH) continue;
+        for (const Wall& w : map.sectors[nr].walls) {
+            for (const WallRef& ref : w.refs) {
+                if (m_depths[ref.sector_nr] >= 0) continue;
+                m_depths[ref.sector_nr] = m_depths[nr] + 1;
+                m_queue.push_back(ref.sector_nr);
+            }
+        }
+    }
+    for (int nr : m_queue) m_depths[nr] = -1;
+
+    glm::vec2 p(loc.pos.x, loc.pos.z);
+    std::vector<float> dists(chunk_count);
+    std::vector<int> requests;
+    for (int i = 0; i < chunk_count; ++i) {
+        const pmap::Chunk& k = m_chunks[i];
+        glm::vec2 d = glm::max(glm::vec2(k.min[0], k.min[1]) - p, p - glm::vec2(k.max[0], k.max[1]));
+        dists[i] = glm::length(glm::max(d, glm::vec2(0)));
+        if (dists[i] <= STREAM_RADIUS) wanted[i] = true;
+        if (wanted[i] && m_chunk_states[i] == ChunkState::Evicted) requests.push_back(i);
+    }
+
+    // nearest chunks first
+    std::sort(requests.begin(), requests.end(), [&dists](int a, int b) { return dists[a] < dists[b]; });
+    if (!requests.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (int i : requests) {
+                JobPtr job(new Job());
+                job->chunk_nr = i;
+                m_todo.push_back(std::move(job));
+                m_chunk_states[i] = ChunkState::Loading;
+            }
+        }
+        m_cond.notify_one();
+    }
+
+    if (m_resident_bytes <= STREAM_BUDGET) return;
+    std::vector<int> victims;
+    for (int i = 0; i < chunk_count; ++i) {
+        if (!wanted[i] && m_chunk_states[i] == ChunkState::Resident) victims.push_back(i);
+    }
+    std::sort(victims.begin(), victims.end(), [&dists](int a, int b) { return dists[a] > dists[b]; });
+    for (int i : victims) {
+        if (m_resident_bytes <= STREAM_BUDGET) break;
+        evict(i);
+    }
+    map.compact_faces();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "map.h"
+#include "pmap.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+
+// pages the faces, vertices and shadow texels of a chunked pmap file in and out around the eye.
+// sectors, portals and cells of the whole map stay resident, so ray_intersect and clip_move
+// work across chunk borders no matter which chunks are loaded.
+// editing the map makes all sectors resident again and stops streaming.
+class WorldStreamer {
+public:
+    ~WorldStreamer();
+
+    // maps the file and sets up the map with no chunks resident, fails for unchunked files
+    bool open(const char* name);
+    void close();
+    bool is_open() const { return m_file != nullptr; }
+
+    // request the chunks around loc, install at most max_installs loaded ones
+    // and evict far chunks while over budget. call once per frame from the main thread
+    void update(const Location& loc, int max_installs = 2);
+
+private:
+    struct Job {
+        int                       chunk_nr;
+        std::vector<pmap::Face>   faces;
+        std::vector<MapVertex>    verts;
+        std::vector<uint8_t>      texels;
+    };
+    typedef std::unique_ptr<Job> JobPtr;
+
+    enum class ChunkState { Evicted, Loading, Resident };
+
+    void load(Job& job) const;
+    void install(const Job& job);
+    void evict(int chunk_nr);
+    void work();
+
+
+    const uint8_t*                  m_file = nullptr;
+    size_t                          m_size = 0;
+    const pmap::Header*             m_header;
+    const pmap::Sector*             m_sectors;
+    const pmap::Chunk*              m_chunks;
+    std::vector<std::vector<int>>   m_chunk_sectors;
+    std::vector<ChunkState>         m_chunk_states;
+    int                             m_revision;
+    size_t                          m_resident_bytes = 0;
+
+    // portal distance of each sector from the eye, -1 if further than STREAM_PORTAL_DEPTH
+    std::vector<int>                m_depths;
+    std::vector<int>                m_queue;
+
+    std::vector<std::thread>        m_threads;
+    std::mutex                      m_mutex;
+    std::condition_variable         m_cond;
+    std::deque<JobPtr>              m_todo;
+    std::deque<JobPtr>              m_done;
+    bool                            m_quit = false;
+};
@@ -0,0 +1,47 @@
+// precompile a text map into a pmap file, which Map::init loads instead
+//
+//     mapcook media/map.txt media/map.pmap
+//
+// -c splits the map into chunks of the given size for streaming. chunked files carry the
+// baked shadow maps, which come from the shadow cache or get baked first
+//
+//     mapcook -c 32 media/map.txt media/map.pmap
+
+#include "../src/map.h"
+#include "../src/jobs.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+int main(int argc, char** argv) {
+    float chunk_size = 0;
+    if (argc == 5 && strcmp(argv[1], "-c") == 0) {
+        chunk_size = atof(argv[2]);
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 3 || chunk_size < 0) {
+        fprintf(stderr, "usage: %s [-c chunk_size] input.txt output.pmap\n", argv[0]);
+        return 1;
+    }
+
+    // baking runs on all cores
+    jobs.init();
+
+    // portals, cells, faces and atlas regions are all set up by load
+    if (!map.load(argv[1])) {
+        fprintf(stderr, "Error: can't load '%s'\n", argv[1]);
+        return 1;
+    }
+    if (chunk_size > 0) map.init_shadows();
+    if (!map.save_pmap(argv[2], chunk_size)) {
+        fprintf(stderr, "Error: can't write '%s'\n", argv[2]);
+        return 1;
+    }
+
+    printf("%s: %d sectors, %d faces, %d vertices\n", argv[2],
+           (int) map.sectors.size(), (int) map.faces.size(), (int) map.verts.size());
+    return 0;
+}
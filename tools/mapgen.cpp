@@ -0,0 +1,108 @@
+// generate a large map for stress tests and benchmarks, writes name.txt and name.pmap
+//
+//     mapgen -sectors 100000 -seed 7 media/big
+//
+// options take a number: -seed -sectors -room -height -variation -portals -doors -concavity -stacked
+// -text skips the pmap file, whose faces need a few GB of memory for a million sectors.
+// -sectors takes 10 to 1000000, files that can't be written completely are removed again
+
+#include "../src/mapgen.h"
+#include "../src/map_text.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+
+
+// the sizes the generated maps are meant for
+#define MIN_SECTORS 10
+#define MAX_SECTORS 1000000
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+int main(int argc, char** argv) {
+    MapGenParams params;
+    struct Option {
+        const char* name;
+        float*      value;
+    } options[] = {
+        { "-room",      &params.room_size },
+        { "-height",    &params.room_height },
+        { "-variation", &params.height_variation },
+        { "-portals",   &params.portals },
+        { "-doors",     &params.doors },
+        { "-concavity", &params.concavity },
+        { "-stacked",   &params.stacked },
+    };
+
+    const char* name = nullptr;
+    bool text_only = false;
+    bool ok = true;
+    for (int i = 1; i < argc && ok; ++i) {
+        if (argv[i][0] != '-') {
+            ok = !name;
+            name = argv[i];
+            continue;
+        }
+        if (strcmp(argv[i], "-text") == 0) {
+            text_only = true;
+            continue;
+        }
+        ok = i + 1 < argc;
+        if (!ok) break;
+        const char* value = argv[++i];
+        if (strcmp(argv[i - 1], "-seed") == 0) params.seed = strtoull(value, nullptr, 10);
+        else if (strcmp(argv[i - 1], "-sectors") == 0) params.sectors = atoi(value);
+        else {
+            ok = false;
+            for (const Option& o : options) {
+                if (strcmp(argv[i - 1], o.name) != 0) continue;
+                *o.value = atof(value);
+                ok = true;
+            }
+        }
+    }
+    if (!ok || !name || params.sectors < MIN_SECTORS || params.sectors > MAX_SECTORS || params.room_size <= 0 || params.stacked < 0 || params.stacked > 1) {
+        fprintf(stderr, "usage: %s [-seed n] [-sectors n] [-room size] [-height h] [-variation v]\n"
+                        "       [-portals p] [-doors p] [-concavity p] [-stacked p] [-text] name\n"
+                        "sectors go from %d to %d, stacked from 0 to 1\n", argv[0], MIN_SECTORS, MAX_SECTORS);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    map.sectors.clear();
+    generate_map(params, map.sectors);
+    printf("generated %d sectors in %.2f s\n", (int) map.sectors.size(), seconds_since(start));
+
+    std::string txt_name = std::string(name) + ".txt";
+    FILE* f = fopen(txt_name.c_str(), "wb");
+    bool written = f && write_map_text(f, map.sectors);
+    if (f && fclose(f) != 0) written = false;
+    if (!written) {
+        if (f) remove(txt_name.c_str());
+        fprintf(stderr, "Error: can't write '%s'\n", txt_name.c_str());
+        return 1;
+    }
+    printf("%s: %d sectors\n", txt_name.c_str(), (int) map.sectors.size());
+    if (text_only) return 0;
+
+    start = std::chrono::steady_clock::now();
+    map.setup_portals();
+    printf("set up portals and faces in %.2f s\n", seconds_since(start));
+
+    std::string pmap_name = std::string(name) + ".pmap";
+    if (!map.save_pmap(pmap_name.c_str())) {
+        remove(pmap_name.c_str());
+        fprintf(stderr, "Error: can't write '%s'\n", pmap_name.c_str());
+        return 1;
+    }
+    printf("%s: %d sectors, %d faces, %d vertices\n", pmap_name.c_str(),
+           (int) map.sectors.size(), (int) map.faces.size(), (int) map.verts.size());
+    return 0;
+}
@@ -0,0 +1,128 @@
+// cook a png into a ktx2 file with all mipmaps, which the texture loader uploads as is
+//
+//     texcook media/wall.png media/wall.ktx2
+
+#include "../src/ktx2.h"
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+
+typedef std::vector<uint8_t> Level;
+
+
+// 2x2 box filter, the last row or column of odd sized levels is folded into its neighbour
+static Level downsample(const Level& src, int w, int h) {
+    int dw = std::max(1, w / 2);
+    int dh = std::max(1, h / 2);
+    Level dst(dw * dh * 4);
+    for (int y = 0; y < dh; ++y)
+    for (int x = 0; x < dw; ++x) {
+        int x0 = x * w / dw, x1 = (x + 1) * w / dw;
+        int y0 = y * h / dh, y1 = (y + 1) * h / dh;
+        for (int c = 0; c < 4; ++c) {
+            int sum = 0;
+            for (int sy = y0; sy < y1; ++sy)
+            for (int sx = x0; sx < x1; ++sx) sum += src[(sy * w + sx) * 4 + c];
+            int n = (x1 - x0) * (y1 - y0);
+            dst[(y * dw + x) * 4 + c] = (sum + n / 2) / n;
+        }
+    }
+    return dst;
+}
+
+
+// data format descriptor for R8G8B8A8_UNORM
+static std::vector<uint32_t> make_dfd() {
+    std::vector<uint32_t> dfd = {
+        0,                  // total size, set below
+        0,                  // vendor id, descriptor type
+        2 | (88 << 16),     // version, block size
+        1 | (1 << 8) | (1 << 16), // model RGBSDA, primaries BT709, linear transfer
+        0,                  // texel block dimensions 1x1x1x1
+        4,                  // bytes plane 0
+        0,
+    };
+    const int channels[] = { 0, 1, 2, 15 };
+    for (int i = 0; i < 4; ++i) {
+        dfd.push_back((i * 8) | (7 << 16) | (channels[i] << 24));
+        dfd.push_back(0);   // sample position
+        dfd.push_back(0);   // lower
+        dfd.push_back(255); // upper
+    }
+    dfd[0] = dfd.size() * 4;
+    return dfd;
+}
+
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s input.png output.ktx2\n", argv[0]);
+        return 1;
+    }
+
+    SDL_Surface* s = IMG_Load(argv[1]);
+    if (!s) {
+        fprintf(stderr, "Error: can't load '%s'\n", argv[1]);
+        return 1;
+    }
+    SDL_Surface* t = SDL_ConvertSurfaceFormat(s, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(s);
+    if (!t) return 1;
+
+    std::vector<Level> levels(1);
+    std::vector<int> widths  = { t->w };
+    std::vector<int> heights = { t->h };
+    for (int y = 0; y < t->h; ++y) {
+        uint8_t* row = (uint8_t*) t->pixels + y * t->pitch;
+        levels[0].insert(levels[0].end(), row, row + t->w * 4);
+    }
+    SDL_FreeSurface(t);
+    while (widths.back() > 1 || heights.back() > 1) {
+        levels.push_back(downsample(levels.back(), widths.back(), heights.back()));
+        widths.push_back(std::max(1, widths.back() / 2));
+        heights.push_back(std::max(1, heights.back() / 2));
+    }
+
+
+    std::vector<uint32_t> dfd = make_dfd();
+
+    ktx2::Header h = {};
+    memcpy(h.identifier, ktx2::IDENTIFIER, sizeof(h.identifier));
+    h.vk_format       = ktx2::VK_FORMAT_R8G8B8A8_UNORM;
+    h.type_size       = 1;
+    h.pixel_width     = widths[0];
+    h.pixel_height    = heights[0];
+    h.face_count      = 1;
+    h.level_count     = levels.size();
+    h.dfd_byte_offset = sizeof(h) + levels.size() * sizeof(ktx2::LevelIndex);
+    h.dfd_byte_length = dfd.size() * 4;
+
+    // level data goes smallest level first, 4 byte texels keep every level aligned
+    std::vector<ktx2::LevelIndex> index(levels.size());
+    uint64_t offset = h.dfd_byte_offset + h.dfd_byte_length;
+    for (int i = levels.size() - 1; i >= 0; --i) {
+        index[i].byte_offset              = offset;
+        index[i].byte_length              = levels[i].size();
+        index[i].uncompressed_byte_length = levels[i].size();
+        offset += levels[i].size();
+    }
+
+    FILE* f = fopen(argv[2], "wb");
+    if (!f) {
+        fprintf(stderr, "Error: can't write '%s'\n", argv[2]);
+        return 1;
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(index.data(), sizeof(ktx2::LevelIndex), index.size(), f);
+    fwrite(dfd.data(), 4, dfd.size(), f);
+    for (int i = levels.size() - 1; i >= 0; --i) fwrite(levels[i].data(), 1, levels[i].size(), f);
+    fclose(f);
+
+    printf("%s: %dx%d, %d levels\n", argv[2], widths[0], heights[0], (int) levels.size());
+    return 0;
+}